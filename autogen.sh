@@ -35,6 +35,15 @@ DIE=0
     DIE=1
 }
 
+(libtoolize --version) < /dev/null > /dev/null 2>&1 || {
+    echo
+    echo "You must have libtool installed to compile $package."
+    echo "Download the appropriate package for your system,"
+    echo "or get the source from one of the GNU ftp sites"
+    echo "listed in http://www.gnu.org/order/ftp.html"
+    DIE=1
+}
+
 (pkg-config --version) < /dev/null > /dev/null 2>&1 || {
     echo
     echo "You must have pkg-config installed to compile $package."
@@ -66,7 +75,8 @@ if [ ! -d "$srcdir/build-scripts" ]; then
 	mkdir "$srcdir/build-scripts"
 fi
 
-run_cmd aclocal
+run_cmd libtoolize --copy --force
+run_cmd aclocal -I build-scripts
 run_cmd autoheader
 run_cmd automake --add-missing --copy
 run_cmd autoconf
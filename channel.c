@@ -0,0 +1,650 @@
+/*
+
+	channel.c
+	A single monitored port and its detectors
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "channel.h"
+#include "rtsafe.h"
+#include "db.h"
+
+
+// Every tone and event count has a place in the journal
+typedef char journal_tones_match[ JOURNAL_TONES == TONE_MAX_FREQS ? 1 : -1 ];
+typedef char journal_events_fit[ JOURNAL_EVENTS >= EVENT_TYPES ? 1 : -1 ];
+
+
+/*
+	Create a channel and start its detectors, without any JACK ports.
+	Audio is given to it with channel_feed(); this is how the simulator
+	drives the detectors.
+*/
+channel_t* channel_create( const rule_t *rule, int labelled, unsigned int sample_rate )
+{
+	channel_t *ch = rt_alloc( sizeof(channel_t) );
+	int i;
+
+	if (!ch) {
+		perror("channel_create(): rt_alloc failed");
+		return NULL;
+	}
+	memcpy( &ch->rule, rule, sizeof(rule_t) );
+	if (labelled) snprintf( ch->label, sizeof(ch->label), "%s: ", rule->name );
+	snprintf( ch->status.port, sizeof(ch->status.port), "%s", rule->name );
+
+	// Set up the tone detectors for this sample rate
+	for (i = 0; i < rule->tone_count; i++) {
+		tone_bank_add( &ch->tones, rule->tones[i] );
+	}
+	tone_bank_init( &ch->tones, sample_rate );
+
+	// Set up the analysers that run in the analysis threads
+	if (rule->flatness > 0.0f) {
+		ch->spectral.threshold = rule->flatness;
+		if (spectral_init( &ch->spectral, sample_rate )) goto fail;
+		ch->worker.spectral = &ch->spectral;
+	}
+	if (rule->settings.loop_period > 0) {
+		if (loop_init( &ch->looper, sample_rate )) goto fail;
+		ch->worker.loop = &ch->looper;
+	}
+	if (rule->similarity > 0.0f) {
+		ch->xcorr.threshold = rule->similarity;
+		if (xcorr_init( &ch->xcorr, sample_rate )) goto fail;
+		ch->worker.xcorr = &ch->xcorr;
+	}
+
+	if (rule->adaptive) {
+		ch->noisefloor.offset = rule->adaptive_offset;
+		noisefloor_init( &ch->noisefloor );
+	}
+
+	// Work out which ports to connect to
+	if (portmatch_compile( &ch->connect_match, rule->connect )) goto fail;
+	if (portmatch_compile( &ch->ref_match, rule->reference )) goto fail;
+
+	if (history_enabled() && history_open( &ch->history, rule->name, sample_rate )) {
+		goto fail;
+	}
+
+	if (ch->worker.spectral || ch->worker.loop || ch->worker.xcorr) {
+		if (worker_init( &ch->worker, sample_rate ) || worker_start( &ch->worker )) goto fail;
+	}
+
+	return ch;
+
+fail:
+	channel_free( NULL, ch );
+	return NULL;
+}
+
+
+/* Create a channel: register its ports and start its detectors */
+channel_t* channel_new( jack_client_t *client, const rule_t *rule, int labelled )
+{
+	channel_t *ch = channel_create( rule, labelled, jack_get_sample_rate( client ) );
+
+	if (ch && channel_register( client, ch )) {
+		channel_free( client, ch );
+		return NULL;
+	}
+
+	return ch;
+}
+
+
+/* Register the channel's ports with a JACK client, forgetting any
+   it had before (after a server restart they no longer exist) */
+int channel_register( jack_client_t *client, channel_t *ch )
+{
+	ch->port = NULL;
+	ch->ref_port = NULL;
+	ch->status.connected = 0;
+
+	if (!(ch->port = jack_port_register(client, ch->rule.name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0))) {
+		fprintf(stderr, "Cannot register input port '%s'.\n", ch->rule.name);
+		return -1;
+	}
+	if (ch->worker.xcorr) {
+		if (!(ch->ref_port = jack_port_register(client, ch->rule.ref_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0))) {
+			fprintf(stderr, "Cannot register input port '%s'.\n", ch->rule.ref_name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Switch to a new rule that needs the same detectors (see rule_same_detectors) */
+void channel_update( channel_t *ch, const rule_t *rule )
+{
+	memcpy( &ch->rule, rule, sizeof(rule_t) );
+	portmatch_free( &ch->connect_match );
+	portmatch_free( &ch->ref_match );
+	portmatch_compile( &ch->connect_match, rule->connect );
+	portmatch_compile( &ch->ref_match, rule->reference );
+	ch->spectral.threshold = rule->flatness;
+	ch->xcorr.threshold = rule->similarity;
+	ch->noisefloor.offset = rule->adaptive_offset;
+}
+
+
+/* Connect an output port to one of ours, if it matches and isn't already */
+static
+int connect_matching( jack_client_t *client, jack_port_t *port, const portmatch_t *pm, const char* name, int quiet )
+{
+	int err;
+
+	if (!port || !portmatch_test( pm, name )) return 0;
+	if (jack_port_connected_to( port, name )) return 0;
+
+	if (!quiet) printf("Connecting %s to %s\n", name, jack_port_name( port ));
+	if ((err = jack_connect(client, name, jack_port_name( port ))) != 0) {
+		fprintf(stderr, "connect_matching(): failed to jack_connect() ports: %d\n",err);
+		return -1;
+	}
+	return 0;
+}
+
+
+// Arguments for connect_each()
+typedef struct {
+	jack_client_t *client;
+	channel_t *ch;
+	int quiet;
+	int result;
+	int matched;
+} connect_args_t;
+
+static
+void connect_each( const char* name, void *arg )
+{
+	connect_args_t *args = arg;
+	channel_t *ch = args->ch;
+
+	if (portmatch_test( &ch->connect_match, name )) args->matched++;
+	args->result |= connect_matching( args->client, ch->port, &ch->connect_match, name, args->quiet );
+	args->result |= connect_matching( args->client, ch->ref_port, &ch->ref_match, name, args->quiet );
+}
+
+
+/* Connect our ports as described by the rule, to every matching port
+   in the index. Returns non-zero if any failed. */
+int channel_connect( jack_client_t *client, channel_t *ch, int quiet )
+{
+	connect_args_t args = { client, ch, quiet, 0, 0 };
+
+	jack_port_disconnect( client, ch->port );
+	if (ch->ref_port) jack_port_disconnect( client, ch->ref_port );
+
+	portindex_each( connect_each, &args );
+	if (!args.matched && ch->rule.connect[0] && !quiet) {
+		printf("Waiting for %s to appear.\n", ch->rule.connect);
+	}
+
+	return args.result;
+}
+
+
+/* An output port has appeared, or been disconnected from us:
+   connect it again if the rule says it should be */
+void channel_follow( jack_client_t *client, channel_t *ch, const char* name, int quiet )
+{
+	connect_matching( client, ch->port, &ch->connect_match, name, quiet );
+	connect_matching( client, ch->ref_port, &ch->ref_match, name, quiet );
+}
+
+
+/* Take a block of audio (and reference audio, or NULL) and its levels.
+   Tone detection happens here, the rest is passed to the analysis threads. */
+static
+void feed_block( channel_t *ch, const float *in, const float *ref, unsigned int nframes,
+                 float block_peak, float block_squares )
+{
+	if (block_peak > ch->peak) {
+		ch->peak = block_peak;
+	}
+	ch->sum_squares += block_squares;
+	ch->samples += nframes;
+
+	/* keep a history of the levels */
+	if (ch->history.file) {
+		history_add( &ch->history, block_peak, block_squares, nframes );
+	}
+
+	/* learn the noise floor */
+	if (ch->rule.adaptive) {
+		noisefloor_add( &ch->noisefloor, block_peak );
+	}
+
+	/* look for tones */
+	if (ch->tones.count) {
+		tone_bank_process( &ch->tones, in, nframes );
+	}
+
+	/* pass audio on to the analysis thread */
+	if (ch->worker.ring) {
+		worker_write( &ch->worker, in, ref, nframes );
+	}
+}
+
+
+/* Take a block of audio (and reference audio, or NULL) */
+void channel_feed( channel_t *ch, const float *in, const float *ref, unsigned int nframes )
+{
+	float block_peak = 0.0f;
+	float block_squares = 0.0f;
+	unsigned int i;
+
+	/* find the peak sample and power */
+	for (i = 0; i < nframes; i++) {
+		const float s = fabsf(in[i]);
+		if (s > block_peak) {
+			block_peak = s;
+		}
+		block_squares += in[i] * in[i];
+	}
+
+	feed_block( ch, in, ref, nframes, block_peak, block_squares );
+}
+
+
+/* Take a block whose peak and sum of squares have already been worked
+   out. The samples themselves are only needed if channel_needs_audio(). */
+void channel_feed_levels( channel_t *ch, const float *in, const float *ref, unsigned int nframes,
+                          float peak, float squares )
+{
+	feed_block( ch, in, ref, nframes, peak, squares );
+}
+
+
+/* Does the channel look at the samples, or only their levels? */
+int channel_needs_audio( const channel_t *ch )
+{
+	return ch->tones.count || ch->worker.ring;
+}
+
+
+/* Called from the process thread for every block of audio */
+void channel_process( channel_t *ch, jack_nframes_t nframes )
+{
+	const float *in = jack_port_get_buffer( ch->port, nframes );
+	const float *ref = NULL;
+
+	if (ch->ref_port) ref = jack_port_get_buffer( ch->ref_port, nframes );
+	channel_feed( ch, in, ref, nframes );
+}
+
+
+/* Read and reset the recent peak sample */
+static
+float read_peak( channel_t *ch )
+{
+	float peakdb = lin2db(ch->peak);
+	ch->peak = 0.0f;
+
+	return peakdb;
+}
+
+
+/* Read and reset the RMS level since last read */
+static
+float read_rms( channel_t *ch )
+{
+	float rmsdb = ch->samples ? lin2db( sqrtf( ch->sum_squares / ch->samples ) ) : -90.0f;
+	ch->sum_squares = 0.0f;
+	ch->samples = 0;
+
+	return rmsdb;
+}
+
+
+static
+int add_event( event_t *events, int n, int type, int duration, float value, float previous )
+{
+	events[n].type = type;
+	events[n].duration = duration;
+	events[n].value = value;
+	events[n].previous = previous;
+	return n + 1;
+}
+
+
+/*
+	Run the detectors over the last second. Called once a second by
+	the monitor thread. Fills in events with anything detected and
+	returns how many there were; the caller is expected to act on them
+	and then start the grace period.
+*/
+int channel_tick( channel_t *ch, int verbose, event_t *events )
+{
+	const rule_t *rule = &ch->rule;
+	const settings_t *cfg = &rule->settings;
+	const char* label = ch->label;
+	status_t *st = &ch->status;
+	float peakdb;
+	int tone_present[TONE_MAX_FREQS];
+	int tone_ident[TONE_MAX_FREQS];
+	unsigned int latency_jumps = 0;
+	int i, n = 0;
+
+	history_flush( &ch->history );
+
+	// Are we in grace period ?
+	if (st->in_grace) {
+		st->in_grace--;
+		if (verbose) printf("%s%d seconds left in grace period.\n", label, st->in_grace);
+		if (rule->adaptive) noisefloor_update( &ch->noisefloor, 0 );
+		return 0;
+	}
+
+	// Check we are connected to something (a channel without ports always is)
+	st->connected = ch->port ? jack_port_connected(ch->port) : 1;
+	if (st->connected==0) {
+		if (verbose) printf("%sInput port isn't connected to anything.\n", label);
+		return 0;
+	}
+
+
+	// Read the recent peak (in decibels)
+	ch->last_peakdb = ch->peakdb;
+	ch->peakdb = peakdb = read_peak( ch );
+	st->peakdb = peakdb;
+	st->rmsdb = read_rms( ch );
+	st->seconds++;
+	st->analysis_dropped = __atomic_load_n( &ch->worker.dropped, __ATOMIC_RELAXED );
+	st->analysis_overruns = __atomic_load_n( &ch->worker.overruns, __ATOMIC_RELAXED );
+
+
+	// Do silence detection?
+	if (cfg->silence_theshold) {
+
+		// Follow the noise floor?
+		st->threshold = cfg->silence_theshold;
+		if (rule->adaptive) {
+			st->threshold = noisefloor_threshold( &ch->noisefloor, cfg->silence_theshold );
+			if (verbose) printf("%sfloor: %2.1fdB threshold: %2.1fdB ", label, ch->noisefloor.floor, st->threshold);
+
+			// Only learn from seconds that aren't silent themselves
+			noisefloor_update( &ch->noisefloor, peakdb >= st->threshold );
+		} else if (verbose) {
+			printf("%s", label);
+		}
+
+		if (verbose) printf("peak: %2.2fdB", peakdb);
+
+		// Is peak too low?
+		if (!rule->reverse) {
+			if (peakdb < st->threshold) {
+				st->silence_count++;
+				if (verbose) printf(" (%d seconds of silence)\n", st->silence_count);
+			} else {
+				if (verbose) printf(" (not silent)\n");
+				st->silence_count=0;
+			}
+		} else {
+			if (peakdb >= st->threshold) {
+				st->silence_count++;
+				if (verbose) printf(" (%d seconds of noise)\n", st->silence_count);
+			} else {
+				if (verbose) printf(" (not noisy)\n");
+				st->silence_count=0;
+			}
+		}
+		// Have we had enough seconds of silence?
+		if (st->silence_count >= cfg->silence_period) {
+			n = add_event( events, n, rule->reverse ? EVENT_NOISY : EVENT_SILENCE, st->silence_count, 0, 0 );
+			st->silence_count = 0;
+		}
+
+	}
+
+
+	// Do no-dynamic detection
+	if (cfg->nodynamic_theshold) {
+
+		if (verbose) printf("%sdelta: %2.2fdB", label, fabs(ch->last_peakdb-peakdb));
+
+		// Check the dynamic/delta between peaks
+		if (!rule->reverse) {
+			if (fabs(ch->last_peakdb-peakdb) < cfg->nodynamic_theshold) {
+				st->nodynamic_count++;
+				if (verbose) printf(" (%d seconds of no dynamic)\n", st->nodynamic_count);
+			} else {
+				if (verbose) printf(" (dynamic)\n");
+				st->nodynamic_count=0;
+			}
+		} else {
+			if (fabs(ch->last_peakdb-peakdb) >= cfg->nodynamic_theshold) {
+				st->nodynamic_count++;
+				if (verbose) printf(" (%d seconds of no dynamic)\n", st->nodynamic_count);
+			} else {
+				if (verbose) printf(" (dynamic)\n");
+				st->nodynamic_count=0;
+			}
+		 }
+		// Have we had enough seconds of no dynamic?
+		if (st->nodynamic_count >= cfg->nodynamic_period) {
+			n = add_event( events, n, EVENT_NO_DYNAMIC, st->nodynamic_count, 0, 0 );
+			st->nodynamic_count = 0;
+		}
+	}
+
+
+	// Do tone detection?
+	if (ch->tones.count) {
+		tone_bank_read( &ch->tones, tone_present, tone_ident );
+
+		for (i = 0; i < ch->tones.count; i++) {
+			if (tone_present[i]) {
+				st->tone_count[i]++;
+				if (verbose) printf("%stone: %gHz at %2.2fdB (%d seconds%s)\n", label,
+					ch->tones.freq[i], ch->tones.level[i], st->tone_count[i],
+					tone_ident[i] ? ", stereo ident" : "");
+			} else {
+				st->tone_count[i] = 0;
+			}
+		}
+
+		// Have we had enough seconds of any tone?
+		for (i = 0; i < ch->tones.count; i++) {
+			if (st->tone_count[i] >= cfg->tone_period) {
+				n = add_event( events, n, tone_ident[i] ? EVENT_STEREO_IDENT : EVENT_TONE,
+				               st->tone_count[i], ch->tones.freq[i], 0 );
+				memset( st->tone_count, 0, sizeof(st->tone_count) );
+				break;
+			}
+		}
+	}
+
+
+	// Do noise (spectral flatness) detection?
+	if (ch->worker.spectral) {
+		if (spectral_read( &ch->spectral )) {
+			st->noise_count++;
+			if (verbose) printf("%sflatness: %1.3f centroid: %1.0fHz (%d seconds of noise)\n", label,
+				ch->spectral.flatness, ch->spectral.centroid, st->noise_count);
+		} else {
+			st->noise_count = 0;
+		}
+
+		// Have we had enough seconds of noise?
+		if (st->noise_count >= cfg->noise_period) {
+			n = add_event( events, n, EVENT_NOISE, st->noise_count, 0, 0 );
+			st->noise_count = 0;
+		}
+	}
+
+
+	// Do looping audio detection?
+	if (ch->worker.loop) {
+		if (loop_read( &ch->looper )) {
+			st->loop_count++;
+			if (verbose) printf("%slooping: %1.2f second loop (%d seconds of looping)\n", label,
+				ch->looper.period, st->loop_count);
+		} else {
+			st->loop_count = 0;
+		}
+
+		// Have we had enough seconds of looping?
+		if (cfg->loop_period && st->loop_count >= cfg->loop_period) {
+			n = add_event( events, n, EVENT_LOOPING, st->loop_count, ch->looper.period, 0 );
+			st->loop_count = 0;
+		}
+	}
+
+
+	// Compare with the reference port?
+	if (ch->worker.xcorr && ch->ref_port && jack_port_connected(ch->ref_port)==0) {
+		if (verbose) printf("%sReference port isn't connected to anything.\n", label);
+	} else if (ch->worker.xcorr) {
+		const float ms = 1000.0f / ch->xcorr.sample_rate;
+
+		if (xcorr_read( &ch->xcorr, &latency_jumps )) {
+			st->mismatch_count++;
+			if (verbose) printf("%ssimilarity: %1.2f (%d seconds of mismatch)\n", label,
+				ch->xcorr.similarity, st->mismatch_count);
+		} else {
+			st->mismatch_count = 0;
+			if (verbose && ch->xcorr.latency >= 0) printf("%ssimilarity: %1.2f latency: %1.1fms\n", label,
+				ch->xcorr.similarity, ms * ch->xcorr.latency);
+		}
+
+		// Has the delay through the chain changed?
+		if (latency_jumps) {
+			n = add_event( events, n, EVENT_LATENCY_CHANGE, 0,
+			               ms * ch->xcorr.latency, ms * ch->xcorr.previous_latency );
+		}
+
+		// Have we had enough seconds of the output not tracking the input?
+		if (st->mismatch_count >= cfg->mismatch_period) {
+			n = add_event( events, n, EVENT_MISMATCH, st->mismatch_count, 0, 0 );
+			st->mismatch_count = 0;
+		}
+	}
+
+
+	// A quiet second with nothing counting ends any alarm
+	if (n == 0 && st->silence_count == 0 && st->nodynamic_count == 0 &&
+	    st->noise_count == 0 && st->loop_count == 0 && st->mismatch_count == 0) {
+		for (i = 0; i < ch->tones.count && st->tone_count[i] == 0; i++);
+		if (i == ch->tones.count) ch->alarm_start = 0;
+	}
+
+	// Anything detected starts the grace period
+	if (n) st->in_grace = cfg->grace_period;
+
+	return n;
+}
+
+
+/* Something was detected at the given time: returns the escalation
+   stage to run, or NULL for the default command */
+const stage_t* channel_alarm( channel_t *ch, time_t now )
+{
+	if (!ch->alarm_start) ch->alarm_start = now;
+	return rule_stage( &ch->rule, now - ch->alarm_start );
+}
+
+
+/* Copy the state of the detectors, for the journal */
+void channel_save( const channel_t *ch, journal_state_t *state, time_t now )
+{
+	const status_t *st = &ch->status;
+	int i;
+
+	memset( state, 0, sizeof(journal_state_t) );
+	snprintf( state->port, sizeof(state->port), "%s", ch->rule.name );
+	state->time = now;
+	state->alarm_start = ch->alarm_start;
+	state->silence_count = st->silence_count;
+	state->nodynamic_count = st->nodynamic_count;
+	state->in_grace = st->in_grace;
+	state->noise_count = st->noise_count;
+	state->loop_count = st->loop_count;
+	state->mismatch_count = st->mismatch_count;
+	for (i = 0; i < TONE_MAX_FREQS; i++) {
+		state->tone_count[i] = st->tone_count[i];
+	}
+	state->seconds = st->seconds;
+	state->commands = st->commands;
+	for (i = 0; i < EVENT_TYPES; i++) {
+		state->events[i] = st->events[i];
+	}
+}
+
+
+static
+int resume( int count, int ran_on )
+{
+	return count > 0 ? count + ran_on : 0;
+}
+
+
+/*
+	Carry on from a state read back from the journal. Anything that was
+	counting at the time was still going at the last journal entry, so
+	the time up to then is added on; time we weren't running at all
+	is only taken off the grace period.
+*/
+void channel_restore( channel_t *ch, const journal_state_t *state, time_t last, time_t now )
+{
+	status_t *st = &ch->status;
+	const int ran_on = last > state->time ? last - state->time : 0;
+	const int gone = now > state->time ? now - state->time : 0;
+	int i;
+
+	st->silence_count = resume( state->silence_count, ran_on );
+	st->nodynamic_count = resume( state->nodynamic_count, ran_on );
+	st->noise_count = resume( state->noise_count, ran_on );
+	st->loop_count = resume( state->loop_count, ran_on );
+	st->mismatch_count = resume( state->mismatch_count, ran_on );
+	for (i = 0; i < TONE_MAX_FREQS; i++) {
+		st->tone_count[i] = resume( state->tone_count[i], ran_on );
+	}
+
+	st->in_grace = state->in_grace > gone ? state->in_grace - gone : 0;
+	ch->alarm_start = state->alarm_start;
+	st->seconds = state->seconds;
+	st->commands = state->commands;
+	for (i = 0; i < EVENT_TYPES; i++) {
+		st->events[i] = state->events[i];
+	}
+}
+
+
+/* Stop the detectors, unregister the ports and free the channel.
+   The process thread must no longer be able to see it. */
+void channel_free( jack_client_t *client, channel_t *ch )
+{
+	worker_finish( &ch->worker );
+	if (ch->worker.spectral) spectral_finish( &ch->spectral );
+	if (ch->worker.loop) loop_finish( &ch->looper );
+	if (ch->worker.xcorr) xcorr_finish( &ch->xcorr );
+
+	history_close( &ch->history );
+	portmatch_free( &ch->connect_match );
+	portmatch_free( &ch->ref_match );
+
+	if (ch->port) jack_port_unregister( client, ch->port );
+	if (ch->ref_port) jack_port_unregister( client, ch->ref_port );
+	rt_free( ch );
+}
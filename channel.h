@@ -0,0 +1,84 @@
+/*
+
+	channel.h
+	A single monitored port and its detectors
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <time.h>
+#include <jack/jack.h>
+
+#include "rules.h"
+#include "status.h"
+#include "goertzel.h"
+#include "spectral.h"
+#include "fingerprint.h"
+#include "xcorr.h"
+#include "worker.h"
+#include "noisefloor.h"
+#include "journal.h"
+#include "history.h"
+#include "portindex.h"
+
+
+typedef struct {
+	char label[RULE_NAME_MAX + 2];	// Prefix for messages: "" or "name: "
+	rule_t rule;					// Rule currently in use
+
+	jack_port_t *port;				// Our input port
+	jack_port_t *ref_port;			// Reference port, for comparing with input
+	portmatch_t connect_match;		// Ports to connect to the input port
+	portmatch_t ref_match;			// Ports to connect to the reference port
+	float peak;						// Current peak signal level (linear)
+	float sum_squares;				// Sum of squared samples since last read
+	unsigned int samples;			// Number of samples in sum_squares
+
+	tone_bank_t tones;				// Bank of tone detectors
+	spectral_t spectral;			// Spectral flatness (noise) detector
+	loop_detector_t looper;			// Looping audio detector
+	xcorr_t xcorr;					// Compares input with the reference port
+	worker_t worker;				// Thread running the expensive analysers
+	noisefloor_t noisefloor;		// Learnt noise floor of the input
+	history_t history;				// Level history, if enabled
+
+	float peakdb;					// The current peak signal level (in dB)
+	float last_peakdb;				// The previous peak signal level (in dB)
+	time_t alarm_start;				// When the current alarm started (0 if none)
+	status_t status;				// State of the detectors
+	journal_state_t journaled;		// State last written to the journal
+} channel_t;
+
+
+channel_t* channel_create( const rule_t *rule, int labelled, unsigned int sample_rate );
+channel_t* channel_new( jack_client_t *client, const rule_t *rule, int labelled );
+int channel_register( jack_client_t *client, channel_t *ch );
+void channel_update( channel_t *ch, const rule_t *rule );
+int channel_connect( jack_client_t *client, channel_t *ch, int quiet );
+void channel_follow( jack_client_t *client, channel_t *ch, const char* name, int quiet );
+void channel_feed( channel_t *ch, const float *in, const float *ref, unsigned int nframes );
+void channel_feed_levels( channel_t *ch, const float *in, const float *ref, unsigned int nframes,
+                          float peak, float squares );
+int channel_needs_audio( const channel_t *ch );
+void channel_process( channel_t *ch, jack_nframes_t nframes );
+int channel_tick( channel_t *ch, int verbose, event_t *events );
+const stage_t* channel_alarm( channel_t *ch, time_t now );
+void channel_save( const channel_t *ch, journal_state_t *state, time_t now );
+void channel_restore( channel_t *ch, const journal_state_t *state, time_t last, time_t now );
+void channel_free( jack_client_t *client, channel_t *ch );
+
+
+#endif
@@ -0,0 +1,364 @@
+/*
+
+	control.c
+	Run-time control socket for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "rules.h"
+#include "history.h"
+
+
+typedef struct {
+	int fd;
+	unsigned int len;
+	char line[CONTROL_LINE_MAX];
+} client_t;
+
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static client_t clients[CONTROL_MAX_CLIENTS];
+static snapshot_t snapshot;				// Copy of the status, for formatting
+static pthread_t thread;
+static int running = 0;
+
+
+static void close_client( client_t *c );
+
+
+/* Never wait on a client: one that isn't reading is dropped */
+static
+void reply( client_t *c, const char* text )
+{
+	size_t len = strlen( text );
+
+	while (len && c->fd >= 0) {
+		ssize_t n = send( c->fd, text, len, MSG_DONTWAIT | MSG_NOSIGNAL );
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) {
+			close_client( c );
+			return;
+		}
+		text += n;
+		len -= n;
+	}
+}
+
+
+static
+void close_client( client_t *c )
+{
+	if (c->fd < 0) return;
+	close( c->fd );
+	c->fd = -1;
+	c->len = 0;
+}
+
+
+/* Apply all of the name/value pairs, or none of them.
+   Applies to every port unless the first word names one. */
+static
+void command_set( client_t *c, char *args )
+{
+	ruleset_t *rs;
+	char *name, *value, *save = NULL;
+	char msg[CONTROL_LINE_MAX + 32];
+	int port = -1, i;
+
+	rules_lock();
+	if (!(rs = rules_copy())) {
+		rules_unlock();
+		reply( c, "ERR out of memory\n" );
+		return;
+	}
+
+	while ((name = strtok_r( args, " \t", &save ))) {
+		if (args && (port = rules_find( rs, name )) >= 0) {
+			args = NULL;
+			continue;
+		}
+		args = NULL;
+		value = strtok_r( NULL, " \t", &save );
+		for (i = 0; i < rs->count; i++) {
+			if (port >= 0 && i != port) continue;
+			if (!value || settings_set( &rs->rule[i].settings, name, value )) {
+				rules_unlock();
+				free( rs );
+				snprintf( msg, sizeof(msg), "ERR invalid setting: %s\n", name );
+				reply( c, msg );
+				return;
+			}
+		}
+	}
+
+	rules_publish( rs );
+	rules_unlock();
+	reply( c, "OK\n" );
+}
+
+
+/* Settings of one port, or of all of them */
+static
+void command_get( client_t *c, char *args )
+{
+	char buf[2048];
+	char *save = NULL;
+	char *name = strtok_r( args, " \t", &save );
+	ruleset_t *rs;
+	int i, port = -1;
+
+	rules_lock();
+	rs = rules_copy();
+	rules_unlock();
+	if (!rs) {
+		reply( c, "ERR out of memory\n" );
+		return;
+	}
+
+	if (name && (port = rules_find( rs, name )) < 0) {
+		reply( c, "ERR unknown port\n" );
+		free( rs );
+		return;
+	}
+
+	for (i = 0; i < rs->count; i++) {
+		if (port >= 0 && i != port) continue;
+		if (port < 0 && rs->count > 1) {
+			snprintf( buf, sizeof(buf), "[%s]\n", rs->rule[i].name );
+			reply( c, buf );
+		}
+		settings_format( &rs->rule[i].settings, buf, sizeof(buf) );
+		reply( c, buf );
+	}
+	reply( c, "OK\n" );
+	free( rs );
+}
+
+
+/* Levels of a port over a range of time. Times are seconds since 1970,
+   or relative to now if zero or negative. */
+static
+void command_history( client_t *c, char *args )
+{
+	char *save = NULL;
+	char *port = strtok_r( args, " \t", &save );
+	char *from = strtok_r( NULL, " \t", &save );
+	char *to = strtok_r( NULL, " \t", &save );
+	int64_t now = time(NULL), start, end;
+	history_result_t r;
+	char buf[256];
+
+	if (!port || !from || !to) {
+		reply( c, "ERR usage: history <port> <from> <to>\n" );
+		return;
+	}
+	start = atoll( from );
+	end = atoll( to );
+	if (start <= 0) start += now;
+	if (end <= 0) end += now;
+
+	if (history_query( port, start * 1000, end * 1000, &r )) {
+		reply( c, "ERR no history for port\n" );
+		return;
+	}
+
+	snprintf( buf, sizeof(buf), "min %.2f\nmax %.2f\nrms %.2f\nseconds %.1f\nOK\n",
+		r.min, r.max, r.rms, r.seconds );
+	reply( c, buf );
+}
+
+
+static
+void command( client_t *c, char *line )
+{
+	char buf[2048];
+	char *args = line + strcspn( line, " \t" );
+
+	if (*args) *args++ = '\0';
+
+	if (strcmp( line, "status" ) == 0) {
+		int i;
+		status_snapshot( &snapshot );
+		for (i = 0; i < snapshot.count; i++) {
+			status_format( &snapshot.status[i], buf, sizeof(buf) );
+			reply( c, buf );
+		}
+		engine_format( &snapshot.engine, buf, sizeof(buf) );
+		reply( c, buf );
+		reply( c, "OK\n" );
+	} else if (strcmp( line, "get" ) == 0) {
+		command_get( c, args );
+	} else if (strcmp( line, "set" ) == 0) {
+		command_set( c, args );
+	} else if (strcmp( line, "history" ) == 0) {
+		command_history( c, args );
+	} else if (strcmp( line, "help" ) == 0) {
+		reply( c, "status\nget [<port>]\nset [<port>] <name> <value> ...\nhistory <port> <from> <to>\nhelp\nquit\nOK\n" );
+	} else if (strcmp( line, "quit" ) == 0) {
+		reply( c, "OK\n" );
+		close_client( c );
+	} else if (*line) {
+		reply( c, "ERR unknown command\n" );
+	}
+}
+
+
+/* Read what is available and run any complete lines */
+static
+void client_read( client_t *c )
+{
+	ssize_t n = read( c->fd, c->line + c->len, sizeof(c->line) - c->len - 1 );
+	char *start, *nl;
+
+	if (n <= 0) {
+		close_client( c );
+		return;
+	}
+	c->len += n;
+	c->line[c->len] = '\0';
+
+	start = c->line;
+	while (c->fd >= 0 && (nl = strchr( start, '\n' ))) {
+		*nl = '\0';
+		if (nl > start && nl[-1] == '\r') nl[-1] = '\0';
+		command( c, start );
+		start = nl + 1;
+	}
+	if (c->fd < 0) return;
+
+	// Keep any partial line for next time
+	c->len -= (start - c->line);
+	memmove( c->line, start, c->len );
+	if (c->len >= sizeof(c->line) - 1) {
+		reply( c, "ERR line too long\n" );
+		close_client( c );
+	}
+}
+
+
+static
+void* control_thread( void *arg )
+{
+	struct pollfd fds[CONTROL_MAX_CLIENTS + 1];
+	int i;
+
+	while (running) {
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+			fds[i+1].fd = clients[i].fd;
+			fds[i+1].events = POLLIN;
+		}
+
+		// Wake up regularly to check if we should still be running
+		if (poll( fds, CONTROL_MAX_CLIENTS + 1, 250 ) <= 0) continue;
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept( listen_fd, NULL, NULL );
+			for (i = 0; fd >= 0 && i < CONTROL_MAX_CLIENTS; i++) {
+				if (clients[i].fd < 0) {
+					clients[i].fd = fd;
+					clients[i].len = 0;
+					fd = -1;
+				}
+			}
+			if (fd >= 0) close( fd );
+		}
+
+		for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+			if (clients[i].fd >= 0 && fds[i+1].fd == clients[i].fd &&
+			    (fds[i+1].revents & (POLLIN | POLLHUP | POLLERR))) {
+				client_read( &clients[i] );
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+int control_start( const char* path )
+{
+	struct sockaddr_un addr;
+	int i;
+
+	if (strlen( path ) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Control socket path is too long: %s\n", path);
+		return -1;
+	}
+
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+	strcpy( socket_path, path );
+
+	if ((listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0) {
+		perror("control_start(): socket failed");
+		return -1;
+	}
+
+	// Remove a stale socket left behind by a previous run
+	unlink( path );
+	if (bind( listen_fd, (struct sockaddr*)&addr, sizeof(addr) ) ||
+	    listen( listen_fd, CONTROL_MAX_CLIENTS )) {
+		perror("control_start(): failed to bind control socket");
+		close( listen_fd );
+		listen_fd = -1;
+		return -1;
+	}
+
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+		clients[i].len = 0;
+	}
+	running = 1;
+	if (pthread_create( &thread, NULL, control_thread, NULL )) {
+		fprintf(stderr, "control_start(): failed to start control thread.\n");
+		running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void control_finish( void )
+{
+	int i;
+
+	if (!running) return;
+	running = 0;
+	pthread_join( thread, NULL );
+
+	for (i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0) close_client( &clients[i] );
+	}
+	close( listen_fd );
+	unlink( socket_path );
+	listen_fd = -1;
+}
@@ -0,0 +1,48 @@
+/*
+
+	control.h
+	Run-time control socket for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "status.h"
+
+
+#define CONTROL_MAX_CLIENTS		8		// Simultaneous connections
+#define CONTROL_LINE_MAX		512		// Longest command line accepted
+
+
+/*
+	A line based protocol on a Unix domain socket, served by its own
+	thread. Every command gets zero or more lines of output followed by
+	either 'OK' or 'ERR <reason>':
+
+	  status                     Detector state, levels and counters of each port
+	  get [<port>]               Current settings
+	  set [<port>] <name> <value> ...
+	                             Change one or more settings at once, for
+	                             the named port or for every port
+	  history <port> <from> <to> Levels over a range of time, in seconds
+	                             since 1970 or relative to now if <= 0
+	  help                       List commands
+	  quit                       Close the connection
+*/
+int control_start( const char* path );
+void control_finish( void );
+
+
+#endif
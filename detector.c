@@ -0,0 +1,172 @@
+/*
+
+	detector.c
+	SilentJack's detectors as a library
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "silentjack.h"
+#include "channel.h"
+
+
+// The public event numbers are the internal ones, and there is room for them
+typedef char sj_event_types_match[ (int)SJ_EVENT_TYPES == (int)EVENT_TYPES ? 1 : -1 ];
+typedef char sj_events_fit[ SJ_EVENTS_MAX >= SJ_EVENT_TYPES ? 1 : -1 ];
+
+
+// A channel without JACK ports, driven by the caller
+struct sj_detector {
+	channel_t *ch;
+};
+
+
+
+/* Apply a NULL terminated list of keys and values to a rule */
+static
+int apply_settings( rule_t *rule, const char* const* settings )
+{
+	int i;
+
+	for (i = 0; settings && settings[i]; i += 2) {
+		if (!settings[i+1]) {
+			fprintf(stderr, "sj_detector: no value for '%s'.\n", settings[i]);
+			return -1;
+		}
+		if (rule_set( rule, settings[i], settings[i+1] )) {
+			fprintf(stderr, "sj_detector: invalid setting: %s = %s\n", settings[i], settings[i+1]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+sj_detector_t* sj_detector_new( const char* name, unsigned int sample_rate, const char* const* settings )
+{
+	sj_detector_t *d;
+	rule_t rule;
+
+	rule_defaults( &rule, name );
+	if (!sample_rate || apply_settings( &rule, settings )) return NULL;
+
+	if (!(d = calloc( 1, sizeof(sj_detector_t) ))) {
+		perror("sj_detector_new(): calloc failed");
+		return NULL;
+	}
+	if (!(d->ch = channel_create( &rule, 0, sample_rate ))) {
+		free( d );
+		return NULL;
+	}
+
+	return d;
+}
+
+
+/* Settings are tried on a copy of the rule, so a bad one changes nothing */
+int sj_detector_set( sj_detector_t *d, const char* const* settings )
+{
+	rule_t rule;
+
+	memcpy( &rule, &d->ch->rule, sizeof(rule_t) );
+	if (apply_settings( &rule, settings )) return -1;
+	if (!rule_same_detectors( &rule, &d->ch->rule )) {
+		fprintf(stderr, "sj_detector_set(): detectors can only be changed with a new detector.\n");
+		return -1;
+	}
+
+	channel_update( d->ch, &rule );
+	return 0;
+}
+
+
+void sj_detector_feed( sj_detector_t *d, const float *in, const float *ref, unsigned int nframes )
+{
+	channel_feed( d->ch, in, ref, nframes );
+}
+
+
+int sj_detector_tick( sj_detector_t *d, time_t now, sj_event_t *events, int max )
+{
+	channel_t *ch = d->ch;
+	event_t found[EVENT_TYPES];
+	int i, n;
+
+	// Unless the program has started a pool of analysis threads, the caller is one
+	if (ch->worker.thread < 0) worker_run( &ch->worker );
+
+	n = channel_tick( ch, 0, found );
+	for (i = 0; i < n; i++) {
+		const stage_t *stage = channel_alarm( ch, now );
+
+		ch->status.events[ found[i].type ]++;
+		if (i >= max) continue;
+		events[i].type = found[i].type;
+		events[i].duration = found[i].duration;
+		events[i].value = found[i].value;
+		events[i].previous = found[i].previous;
+		events[i].command = stage ? stage->command : NULL;
+	}
+
+	return n;
+}
+
+
+void sj_detector_state( const sj_detector_t *d, sj_state_t *state )
+{
+	const status_t *st = &d->ch->status;
+	int i;
+
+	memset( state, 0, sizeof(sj_state_t) );
+	state->connected = st->connected;
+	state->peakdb = st->peakdb;
+	state->rmsdb = st->rmsdb;
+	state->threshold = st->threshold;
+	state->silence_count = st->silence_count;
+	state->nodynamic_count = st->nodynamic_count;
+	state->in_grace = st->in_grace;
+	for (i = 0; i < TONE_MAX_FREQS; i++) {
+		if (st->tone_count[i] > state->tone_count) state->tone_count = st->tone_count[i];
+	}
+	state->noise_count = st->noise_count;
+	state->loop_count = st->loop_count;
+	state->mismatch_count = st->mismatch_count;
+	state->seconds = st->seconds;
+	memcpy( state->events, st->events, sizeof(st->events) );
+	state->dropped = st->analysis_dropped;
+}
+
+
+void sj_detector_free( sj_detector_t *d )
+{
+	if (!d) return;
+	channel_free( NULL, d->ch );
+	free( d );
+}
+
+
+const char* sj_event_name( int type )
+{
+	return event_name( type );
+}
+
+
+int sj_api_version( void )
+{
+	return SJ_API_VERSION;
+}
@@ -0,0 +1,301 @@
+/*
+
+	eventlog.c
+	Structured event log for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <jack/ringbuffer.h>
+
+#include "eventlog.h"
+#include "status.h"
+
+
+enum { FSYNC_NONE, FSYNC_ROTATE, FSYNC_BATCH };
+
+static char path[1024];				// Name of the current log file
+static int binary = 0;				// True for binary records, otherwise JSON
+static off_t max_size = 0;			// Rotate at this size (0 = never)
+static time_t max_age = 0;			// Rotate at this age (0 = never)
+static int keep = 5;				// Rotated files to keep
+static int fsync_policy = FSYNC_ROTATE;
+
+static jack_ringbuffer_t *queue = NULL;
+static unsigned long dropped = 0;	// Records that didn't fit in the queue
+static pthread_t thread;
+static int running = 0;
+
+// Only used by the writer thread
+static int fd = -1;
+static off_t size = 0;				// Size of current file
+static time_t opened = 0;			// When current file was started
+static char batch[EVENTLOG_QUEUE * 512];
+
+
+static
+int parse_spec( const char* spec )
+{
+	char copy[sizeof(path)];
+	char *name, *opt, *save = NULL;
+
+	if (strlen( spec ) >= sizeof(copy)) {
+		fprintf(stderr, "Event log spec is too long: %s\n", spec);
+		return -1;
+	}
+	strcpy( copy, spec );
+	if (!(name = strtok_r( copy, ",", &save ))) {
+		fprintf(stderr, "Event log file name is missing.\n");
+		return -1;
+	}
+	strcpy( path, name );
+
+	while ((opt = strtok_r( NULL, ",", &save ))) {
+		char *value = strchr( opt, '=' ), *end;
+		if (!value) goto error;
+		*value++ = '\0';
+
+		if (strcmp( opt, "format" ) == 0) {
+			if (strcmp( value, "binary" ) == 0) binary = 1;
+			else if (strcmp( value, "json" ) == 0) binary = 0;
+			else goto error;
+		} else if (strcmp( opt, "size" ) == 0) {
+			max_size = strtol( value, &end, 10 );
+			if (*end == 'k') max_size *= 1024;
+			else if (*end == 'M') max_size *= 1024 * 1024;
+			else if (*end) goto error;
+		} else if (strcmp( opt, "age" ) == 0) {
+			max_age = atoi( value );
+		} else if (strcmp( opt, "keep" ) == 0) {
+			keep = abs(atoi( value ));
+		} else if (strcmp( opt, "fsync" ) == 0) {
+			if (strcmp( value, "none" ) == 0) fsync_policy = FSYNC_NONE;
+			else if (strcmp( value, "rotate" ) == 0) fsync_policy = FSYNC_ROTATE;
+			else if (strcmp( value, "batch" ) == 0) fsync_policy = FSYNC_BATCH;
+			else goto error;
+		} else {
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	fprintf(stderr, "Invalid event log setting: %s\n", opt);
+	return -1;
+}
+
+
+static
+void write_all( const char* data, size_t len )
+{
+	while (len && fd >= 0) {
+		ssize_t n = write( fd, data, len );
+		if (n <= 0) {
+			perror("eventlog: write failed");
+			return;
+		}
+		data += n;
+		len -= n;
+		size += n;
+	}
+}
+
+
+static
+int open_log( void )
+{
+	struct stat st;
+
+	if ((fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 )) < 0) {
+		perror( path );
+		return -1;
+	}
+
+	size = (fstat( fd, &st ) == 0) ? st.st_size : 0;
+	opened = time(NULL);
+
+	// A new binary log starts with a header
+	if (binary && size == 0) {
+		eventlog_header_t header;
+		memcpy( header.magic, EVENTLOG_MAGIC, 4 );
+		header.version = EVENTLOG_VERSION;
+		header.record_size = sizeof(eventlog_record_t);
+		header.event_types = EVENT_TYPES;
+		write_all( (const char*)&header, sizeof(header) );
+	}
+
+	return 0;
+}
+
+
+/* Move log to log.1, log.1 to log.2 and so on, and start a new log */
+static
+void rotate( void )
+{
+	char from[sizeof(path) + 16], to[sizeof(path) + 16];
+	int i;
+
+	if (fsync_policy != FSYNC_NONE) fsync( fd );
+	close( fd );
+	fd = -1;
+
+	for (i = keep; i > 0; i--) {
+		if (i > 1) snprintf( from, sizeof(from), "%s.%d", path, i - 1 );
+		else snprintf( from, sizeof(from), "%s", path );
+		snprintf( to, sizeof(to), "%s.%d", path, i );
+		rename( from, to );
+	}
+	if (keep == 0) unlink( path );
+
+	open_log();
+}
+
+
+static
+int format_json( const eventlog_record_t *rec, char *buf, int len )
+{
+	const time_t secs = rec->time / 1000000;
+	char when[32], port[sizeof(rec->port) * 2];
+	const char* s;
+	char *d = port;
+	struct tm tm;
+
+	gmtime_r( &secs, &tm );
+	strftime( when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm );
+
+	for (s = rec->port; *s && s < rec->port + sizeof(rec->port); s++) {
+		if (*s == '"' || *s == '\\') *d++ = '\\';
+		if ((unsigned char)*s >= ' ') *d++ = *s;
+	}
+	*d = '\0';
+
+	return snprintf( buf, len,
+		"{\"time\":\"%s.%06uZ\",\"frames\":%llu,\"port\":\"%s\",\"event\":\"%s\","
+		"\"duration\":%g,\"peak\":%.2f,\"rms\":%.2f,\"threshold\":%.2f,"
+		"\"value\":%g,\"previous\":%g,\"cpu_load\":%.1f,\"xruns\":%u}\n",
+		when, (unsigned int)(rec->time % 1000000), (unsigned long long)rec->frames, port,
+		event_name( rec->type ),
+		rec->duration, rec->peakdb, rec->rmsdb, rec->threshold,
+		rec->value, rec->previous, rec->cpu_load, rec->xruns );
+}
+
+
+/* Write out everything in the queue in one go */
+static
+void flush( void )
+{
+	eventlog_record_t rec;
+	int len = 0;
+
+	while (jack_ringbuffer_read_space( queue ) >= sizeof(rec) &&
+	       len < (int)sizeof(batch) - 512) {
+		jack_ringbuffer_read( queue, (char*)&rec, sizeof(rec) );
+		if (binary) {
+			memcpy( batch + len, &rec, sizeof(rec) );
+			len += sizeof(rec);
+		} else {
+			len += format_json( &rec, batch + len, sizeof(batch) - len );
+		}
+	}
+	if (len == 0) return;
+
+	write_all( batch, len );
+	if (fsync_policy == FSYNC_BATCH) fdatasync( fd );
+}
+
+
+static
+void* eventlog_thread( void *arg )
+{
+	int stopping = 0;
+
+	while (!stopping) {
+		stopping = !__atomic_load_n( &running, __ATOMIC_ACQUIRE );
+		if (!stopping) usleep( EVENTLOG_FLUSH_MS * 1000 );
+
+		if (fd < 0) continue;
+		flush();
+
+		if ((max_size && size >= max_size) || (max_age && time(NULL) - opened >= max_age)) {
+			rotate();
+		}
+	}
+
+	return NULL;
+}
+
+
+int eventlog_start( const char* spec )
+{
+	if (parse_spec( spec )) return -1;
+
+	if (!(queue = jack_ringbuffer_create( sizeof(eventlog_record_t) * EVENTLOG_QUEUE ))) {
+		fprintf(stderr, "eventlog_start(): failed to create ring buffer.\n");
+		return -1;
+	}
+	if (open_log()) return -1;
+
+	running = 1;
+	if (pthread_create( &thread, NULL, eventlog_thread, NULL )) {
+		fprintf(stderr, "eventlog_start(): failed to start writer thread.\n");
+		running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Queue a record for writing. Never blocks: if the writer has fallen
+   that far behind, the record is counted and dropped. */
+void eventlog_write( const eventlog_record_t *rec )
+{
+	if (!running) return;
+
+	if (jack_ringbuffer_write_space( queue ) < sizeof(eventlog_record_t)) {
+		dropped++;
+		return;
+	}
+	jack_ringbuffer_write( queue, (const char*)rec, sizeof(eventlog_record_t) );
+}
+
+
+unsigned long eventlog_dropped( void )
+{
+	return dropped;
+}
+
+
+void eventlog_finish( void )
+{
+	if (!running) return;
+
+	// The writer thread flushes what is left before stopping
+	__atomic_store_n( &running, 0, __ATOMIC_RELEASE );
+	pthread_join( thread, NULL );
+
+	if (fsync_policy != FSYNC_NONE) fsync( fd );
+	close( fd );
+	fd = -1;
+	jack_ringbuffer_free( queue );
+	queue = NULL;
+}
@@ -0,0 +1,75 @@
+/*
+
+	eventlog.h
+	Structured event log for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+
+
+#define EVENTLOG_QUEUE			256		// Records waiting to be written
+#define EVENTLOG_FLUSH_MS		200		// How often the writer thread wakes up
+#define EVENTLOG_MAGIC			"SJEV"	// Start of a binary log file
+#define EVENTLOG_VERSION		2
+
+
+/* One event. Binary logs are a header followed by these, as is. */
+typedef struct {
+	uint64_t time;				// Wall clock time (microseconds since 1970)
+	uint64_t frames;			// JACK frame time
+	char port[64];				// Name of the port
+	uint32_t type;				// Event type, see status.h (port or engine)
+	float duration;				// How long the condition lasted (seconds)
+	float peakdb;				// Peak level in the last second (dB)
+	float rmsdb;				// RMS level in the last second (dB)
+	float threshold;			// Silence threshold in use (dB)
+	float value;				// Tone frequency (Hz), loop period (s), new latency (ms),
+								// or new buffer size or sample rate
+	float previous;				// Previous latency (ms), buffer size or sample rate
+	float cpu_load;				// JACK DSP load at the time (percent)
+	uint32_t xruns;				// Xruns in the last XRUN_WINDOW seconds
+} eventlog_record_t;
+
+typedef struct {
+	char magic[4];				// EVENTLOG_MAGIC
+	uint32_t version;			// EVENTLOG_VERSION
+	uint32_t record_size;		// sizeof(eventlog_record_t)
+	uint32_t event_types;		// Number of port event types
+} eventlog_header_t;
+
+
+/*
+	Records are queued without blocking and written out in batches
+	by a writer thread, so a slow disk never holds up detection.
+	The spec is the file name followed by optional comma separated
+	settings:
+
+	  format=json|binary    JSON Lines (default) or binary records
+	  size=<bytes>[k|M]     Rotate when the file gets this big
+	  age=<secs>            Rotate when the file is this old
+	  keep=<n>              Number of rotated files to keep (default 5)
+	  fsync=none|rotate|batch
+	                        When to fsync (default rotate)
+*/
+int eventlog_start( const char* spec );
+void eventlog_write( const eventlog_record_t *rec );
+unsigned long eventlog_dropped( void );
+void eventlog_finish( void );
+
+
+#endif
@@ -0,0 +1,183 @@
+/*
+
+	fft.c
+	Real-input FFT for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "fft.h"
+
+
+/* Create FFT plan for the given size, which must be a power of two */
+fft_t* fft_new( unsigned int size )
+{
+	fft_t *fft = NULL;
+	unsigned int i, bits = 0;
+
+	if (size < 4 || (size & (size - 1))) {
+		fprintf(stderr, "fft_new(): size must be a power of two: %u\n", size);
+		return NULL;
+	}
+
+	fft = calloc( 1, sizeof(fft_t) );
+	if (!fft) return NULL;
+	fft->size = size;
+	fft->half = size / 2;
+	while ((1U << bits) < fft->half) bits++;
+
+	fft->bitrev = malloc( sizeof(unsigned int) * fft->half );
+	fft->tw_re = malloc( sizeof(float) * fft->half / 2 );
+	fft->tw_im = malloc( sizeof(float) * fft->half / 2 );
+	fft->split_re = malloc( sizeof(float) * fft->half );
+	fft->split_im = malloc( sizeof(float) * fft->half );
+	fft->work_re = malloc( sizeof(float) * fft->half );
+	fft->work_im = malloc( sizeof(float) * fft->half );
+	if (!fft->bitrev || !fft->tw_re || !fft->tw_im || !fft->split_re ||
+	    !fft->split_im || !fft->work_re || !fft->work_im) {
+		fft_free( fft );
+		return NULL;
+	}
+
+	for (i = 0; i < fft->half; i++) {
+		unsigned int r = 0, b;
+		for (b = 0; b < bits; b++) {
+			if (i & (1U << b)) r |= 1U << (bits - 1 - b);
+		}
+		fft->bitrev[i] = r;
+	}
+
+	for (i = 0; i < fft->half / 2; i++) {
+		fft->tw_re[i] = cos(-2.0 * M_PI * i / fft->half);
+		fft->tw_im[i] = sin(-2.0 * M_PI * i / fft->half);
+	}
+
+	for (i = 0; i < fft->half; i++) {
+		fft->split_re[i] = cos(-2.0 * M_PI * i / fft->size);
+		fft->split_im[i] = sin(-2.0 * M_PI * i / fft->size);
+	}
+
+	return fft;
+}
+
+
+void fft_free( fft_t *fft )
+{
+	if (!fft) return;
+	free( fft->bitrev );
+	free( fft->tw_re );
+	free( fft->tw_im );
+	free( fft->split_re );
+	free( fft->split_im );
+	free( fft->work_re );
+	free( fft->work_im );
+	free( fft );
+}
+
+
+/* In-place iterative radix-2 complex FFT on already bit-reversed data */
+static
+void fft_complex( fft_t *fft, float *re, float *im )
+{
+	const unsigned int n = fft->half;
+	unsigned int len, i, j;
+
+	for (len = 2; len <= n; len <<= 1) {
+		const unsigned int h = len / 2;
+		const unsigned int step = n / len;
+		for (i = 0; i < n; i += len) {
+			for (j = 0; j < h; j++) {
+				const float wr = fft->tw_re[j * step];
+				const float wi = fft->tw_im[j * step];
+				const float vr = re[i+j+h] * wr - im[i+j+h] * wi;
+				const float vi = re[i+j+h] * wi + im[i+j+h] * wr;
+				re[i+j+h] = re[i+j] - vr;
+				im[i+j+h] = im[i+j] - vi;
+				re[i+j] += vr;
+				im[i+j] += vi;
+			}
+		}
+	}
+}
+
+
+/* Forward FFT of size real samples. Writes size/2+1 bins to out_re/out_im */
+void fft_real( fft_t *fft, const float *in, float *out_re, float *out_im )
+{
+	const unsigned int n = fft->half;
+	float *zr = fft->work_re;
+	float *zi = fft->work_im;
+	unsigned int k;
+
+	// Pack even samples as real part, odd samples as imaginary part
+	for (k = 0; k < n; k++) {
+		const unsigned int r = fft->bitrev[k];
+		zr[r] = in[2*k];
+		zi[r] = in[2*k+1];
+	}
+
+	fft_complex( fft, zr, zi );
+
+	// Split the packed spectrum into the spectrum of the real signal
+	out_re[0] = zr[0] + zi[0];
+	out_im[0] = 0.0f;
+	out_re[n] = zr[0] - zi[0];
+	out_im[n] = 0.0f;
+	for (k = 1; k < n; k++) {
+		const float ar = zr[k], ai = zi[k];
+		const float br = zr[n-k], bi = -zi[n-k];
+		const float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+		const float or_ = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+		const float wr = fft->split_re[k], wi = fft->split_im[k];
+		out_re[k] = er + (or_ * wr - oi * wi);
+		out_im[k] = ei + (or_ * wi + oi * wr);
+	}
+}
+
+
+/* Inverse of fft_real(): takes size/2+1 bins and writes size real samples.
+   The result is scaled so that fft_real() followed by this is a no-op. */
+void fft_real_inverse( fft_t *fft, const float *in_re, const float *in_im, float *out )
+{
+	const unsigned int n = fft->half;
+	const float scale = 1.0f / fft->half;
+	float *zr = fft->work_re;
+	float *zi = fft->work_im;
+	unsigned int k;
+
+	// Undo the split pass, conjugating so a forward FFT does the inverse
+	for (k = 0; k < n; k++) {
+		const float ar = in_re[k], ai = in_im[k];
+		const float br = in_re[n-k], bi = -in_im[n-k];
+		const float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+		const float dr = 0.5f * (ar - br), di = 0.5f * (ai - bi);
+		const float wr = fft->split_re[k], wi = -fft->split_im[k];
+		const float or_ = dr * wr - di * wi;
+		const float oi = dr * wi + di * wr;
+		const unsigned int r = fft->bitrev[k];
+		zr[r] = er - oi;
+		zi[r] = -(ei + or_);
+	}
+
+	fft_complex( fft, zr, zi );
+
+	for (k = 0; k < n; k++) {
+		out[2*k] = zr[k] * scale;
+		out[2*k+1] = -zi[k] * scale;
+	}
+}
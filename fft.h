@@ -0,0 +1,48 @@
+/*
+
+	fft.h
+	Real-input FFT for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef FFT_H
+#define FFT_H
+
+
+/*
+	A real FFT of size N is done as a complex FFT of size N/2 on the
+	even/odd samples packed together, followed by a split pass.
+	All twiddle factors and the bit-reversal table are worked out
+	once in fft_new(), so fft_real() does no trigonometry at all.
+*/
+typedef struct {
+	unsigned int size;		// Number of real input samples (power of 2)
+	unsigned int half;		// size / 2, size of the complex FFT
+	unsigned int *bitrev;	// Bit reversal permutation for the complex FFT
+	float *tw_re;			// Twiddles for the complex FFT (half/2 entries)
+	float *tw_im;
+	float *split_re;		// Twiddles for the split pass (half entries)
+	float *split_im;
+	float *work_re;			// Scratch space (half entries)
+	float *work_im;
+} fft_t;
+
+
+fft_t* fft_new( unsigned int size );
+void fft_free( fft_t *fft );
+void fft_real( fft_t *fft, const float *in, float *out_re, float *out_im );
+void fft_real_inverse( fft_t *fft, const float *in_re, const float *in_im, float *out );
+
+
+#endif
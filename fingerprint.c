@@ -0,0 +1,185 @@
+/*
+
+	fingerprint.c
+	Looping audio detector for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "fingerprint.h"
+#include "db.h"
+
+
+#define LOOP_LOW_HZ			100.0f	// Bottom of the lowest band
+#define LOOP_HIGH_HZ		8000.0f	// Top of the highest band
+#define LOOP_DECAY_SECS		1.0f	// Time constant of the distance averages
+#define LOOP_MIN_VARIATION	20.0f	// Audio that changes less than this is steady, not looping
+#define LOOP_MATCH_RATIO	0.25f	// Best lag must be this much closer than average
+
+
+int loop_init( loop_detector_t *ld, unsigned int sample_rate )
+{
+	const float bin_hz = (float)sample_rate / LOOP_FRAME_SIZE;
+	unsigned int i;
+
+	memset( ld, 0, sizeof(loop_detector_t) );
+	ld->sample_rate = sample_rate;
+	ld->fft = fft_new( LOOP_FRAME_SIZE );
+	if (!ld->fft) return -1;
+
+	for (i = 0; i < LOOP_FRAME_SIZE; i++) {
+		ld->window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / LOOP_FRAME_SIZE);
+	}
+
+	// Logarithmically spaced bands
+	for (i = 0; i <= LOOP_BANDS; i++) {
+		float hz = LOOP_LOW_HZ * powf(LOOP_HIGH_HZ / LOOP_LOW_HZ, (float)i / LOOP_BANDS);
+		unsigned int bin = hz / bin_hz;
+		if (bin < 1) bin = 1;
+		if (bin > LOOP_FRAME_SIZE/2) bin = LOOP_FRAME_SIZE/2;
+		if (i > 0 && bin <= ld->band_start[i-1]) bin = ld->band_start[i-1] + 1;
+		ld->band_start[i] = bin;
+	}
+
+	ld->min_lag = (unsigned long)sample_rate * LOOP_MIN_MS / 1000 / LOOP_HOP_SIZE;
+	ld->max_lag = (unsigned long)sample_rate * LOOP_MAX_MS / 1000 / LOOP_HOP_SIZE;
+	if (ld->min_lag < 2) ld->min_lag = 2;
+	if (ld->max_lag > LOOP_HISTORY - 1) ld->max_lag = LOOP_HISTORY - 1;
+	ld->decay = expf( -(float)LOOP_HOP_SIZE / (LOOP_DECAY_SECS * sample_rate) );
+
+	return 0;
+}
+
+
+/* Reduce the current frame to a fingerprint */
+static
+void loop_fingerprint( loop_detector_t *ld, unsigned char *fp )
+{
+	unsigned int i, b, k;
+
+	for (i = 0; i < LOOP_FRAME_SIZE; i++) {
+		ld->buf[i] = ld->frame[i] * ld->window[i];
+	}
+	fft_real( ld->fft, ld->buf, ld->re, ld->im );
+
+	for (b = 0; b < LOOP_BANDS; b++) {
+		float energy = 0.0f, db;
+		for (k = ld->band_start[b]; k < ld->band_start[b+1]; k++) {
+			energy += ld->re[k] * ld->re[k] + ld->im[k] * ld->im[k];
+		}
+		db = 10.0f * log10f( energy + 1e-10f );
+
+		// Half decibel steps from -100dB upwards
+		db = (db + 100.0f) * 2.0f;
+		if (db < 0.0f) db = 0.0f;
+		if (db > 255.0f) db = 255.0f;
+		fp[b] = db;
+	}
+}
+
+
+/* Take a fingerprint and compare it against the history */
+static
+void loop_analyse( loop_detector_t *ld )
+{
+	const unsigned int now = ld->frames & (LOOP_HISTORY - 1);
+	const unsigned char *fp = ld->history[now];
+	float best = 0.0f, mean = 0.0f;
+	unsigned int lag, best_lag = 0;
+
+	loop_fingerprint( ld, ld->history[now] );
+	ld->frames++;
+
+	for (lag = ld->min_lag; lag <= ld->max_lag && lag < ld->frames; lag++) {
+		const unsigned char *old = ld->history[(ld->frames - 1 - lag) & (LOOP_HISTORY - 1)];
+		float d = 0.0f;
+		unsigned int b;
+
+		for (b = 0; b < LOOP_BANDS; b++) {
+			const float diff = ((int)fp[b] - (int)old[b]) * 0.5f;
+			d += diff * diff;
+		}
+		ld->dist[lag] = ld->dist[lag] * ld->decay + d * (1.0f - ld->decay);
+	}
+
+	// Wait for the full range of lags to have some history
+	if (ld->frames <= ld->max_lag + ld->max_lag) return;
+
+	for (lag = ld->min_lag; lag <= ld->max_lag; lag++) {
+		mean += ld->dist[lag];
+		if (!best_lag || ld->dist[lag] < best) {
+			best = ld->dist[lag];
+			best_lag = lag;
+		}
+	}
+	mean /= (ld->max_lag - ld->min_lag + 1);
+
+	// Steady audio (silence, tone, hiss) matches at every lag
+	if (mean >= LOOP_MIN_VARIATION && best < mean * LOOP_MATCH_RATIO) {
+		// Multiples of the loop length match too: report the shortest
+		for (lag = ld->min_lag; lag < best_lag; lag++) {
+			if (ld->dist[lag] < mean * LOOP_MATCH_RATIO &&
+			    ld->dist[lag] <= ld->dist[lag-1] && ld->dist[lag] <= ld->dist[lag+1]) {
+				best_lag = lag;
+				break;
+			}
+		}
+		ld->period = (float)best_lag * LOOP_HOP_SIZE / ld->sample_rate;
+		__atomic_add_fetch( &ld->looping, 1, __ATOMIC_RELEASE );
+	}
+	__atomic_add_fetch( &ld->hops, 1, __ATOMIC_RELEASE );
+}
+
+
+/* Collect samples into overlapping frames (called from the worker thread) */
+void loop_process( loop_detector_t *ld, const float *in, unsigned int nframes )
+{
+	while (nframes) {
+		unsigned int n = LOOP_HOP_SIZE - ld->fill;
+		if (n > nframes) n = nframes;
+
+		// Slide the frame along and append the new samples
+		memmove( ld->frame, ld->frame + n, sizeof(float) * (LOOP_FRAME_SIZE - n) );
+		memcpy( ld->frame + LOOP_FRAME_SIZE - n, in, sizeof(float) * n );
+		ld->fill += n;
+		in += n;
+		nframes -= n;
+
+		if (ld->fill == LOOP_HOP_SIZE) {
+			loop_analyse( ld );
+			ld->fill = 0;
+		}
+	}
+}
+
+
+/* True if most frames since the last call looked like a loop */
+int loop_read( loop_detector_t *ld )
+{
+	unsigned int hops = __atomic_exchange_n( &ld->hops, 0, __ATOMIC_ACQ_REL );
+	unsigned int looping = __atomic_exchange_n( &ld->looping, 0, __ATOMIC_ACQ_REL );
+
+	return (hops && looping * 2 > hops);
+}
+
+
+void loop_finish( loop_detector_t *ld )
+{
+	fft_free( ld->fft );
+	ld->fft = NULL;
+}
@@ -0,0 +1,74 @@
+/*
+
+	fingerprint.h
+	Looping audio detector for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include "fft.h"
+
+
+#define LOOP_FRAME_SIZE		1024	// Samples per fingerprint frame
+#define LOOP_HOP_SIZE		512		// Samples between fingerprint frames
+#define LOOP_BANDS			16		// Number of energy bands per fingerprint
+#define LOOP_HISTORY		512		// Number of fingerprints kept (power of 2)
+#define LOOP_MIN_MS			100		// Shortest loop looked for
+#define LOOP_MAX_MS			2000	// Longest loop looked for
+
+
+/*
+	Each frame is reduced to a fingerprint of LOOP_BANDS log band
+	energies, quantised to half a decibel. For every candidate loop
+	length the detector keeps a decaying average of how different each
+	fingerprint is from the one that many frames earlier. When the
+	audio is looping, one lag (and its multiples) stands out as being
+	far closer than all of the others.
+
+	Memory use is fixed: LOOP_HISTORY fingerprints plus one float per lag.
+*/
+typedef struct {
+	unsigned int sample_rate;
+	fft_t *fft;
+	float window[LOOP_FRAME_SIZE];
+	float frame[LOOP_FRAME_SIZE];			// Most recent frame of audio
+	float buf[LOOP_FRAME_SIZE];				// Windowed copy of frame
+	float re[LOOP_FRAME_SIZE/2+1];
+	float im[LOOP_FRAME_SIZE/2+1];
+	unsigned int fill;						// New samples in frame since last hop
+	unsigned int band_start[LOOP_BANDS+1];	// First FFT bin of each band
+
+	unsigned char history[LOOP_HISTORY][LOOP_BANDS];	// Ring of fingerprints
+	unsigned long frames;					// Number of fingerprints taken
+	unsigned int min_lag;					// Range of lags searched (in frames)
+	unsigned int max_lag;
+	float decay;							// Per-frame decay of the distances
+	float dist[LOOP_HISTORY];				// Average distance at each lag
+
+	// Written by the worker thread, collected by loop_read()
+	unsigned int hops;						// Frames analysed since last read
+	unsigned int looping;					// Frames which looked like a loop
+	float period;							// Length of loop most recently seen (secs)
+} loop_detector_t;
+
+
+int loop_init( loop_detector_t *ld, unsigned int sample_rate );
+void loop_process( loop_detector_t *ld, const float *in, unsigned int nframes );
+int loop_read( loop_detector_t *ld );
+void loop_finish( loop_detector_t *ld );
+
+
+#endif
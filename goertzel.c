@@ -0,0 +1,210 @@
+/*
+
+	goertzel.c
+	Bank of Goertzel tone detectors for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "goertzel.h"
+#include "db.h"
+
+
+// EBU stereo ident timings, in milliseconds
+#define IDENT_GAP_MIN		150
+#define IDENT_GAP_MAX		350
+#define IDENT_PERIOD_MIN	2500
+#define IDENT_PERIOD_MAX	3500
+
+
+/* Add a frequency to the bank, returns non-zero if the bank is full */
+int tone_bank_add( tone_bank_t *bank, float freq )
+{
+	if (bank->count >= TONE_MAX_FREQS) return -1;
+	if (freq <= 0.0f) return -1;
+
+	bank->freq[ bank->count++ ] = freq;
+	return 0;
+}
+
+
+/* Work out decimation and coefficients for the given sample rate */
+void tone_bank_init( tone_bank_t *bank, unsigned int sample_rate )
+{
+	float max_freq = 0.0f;
+	float dec_rate;
+	int i;
+
+	for (i = 0; i < bank->count; i++) {
+		if (bank->freq[i] > max_freq) max_freq = bank->freq[i];
+	}
+
+	// Decimate so that the highest tone sits well below Nyquist
+	bank->decimate = 1;
+	if (max_freq > 0.0f && sample_rate > 4 * max_freq) {
+		bank->decimate = sample_rate / (unsigned int)(4 * max_freq);
+	}
+	dec_rate = (float)sample_rate / bank->decimate;
+	bank->block_len = dec_rate * TONE_WINDOW_MS / 1000;
+	if (bank->block_len < 1) bank->block_len = 1;
+
+	for (i = 0; i < TONE_MAX_FREQS; i++) {
+		if (i < bank->count) {
+			bank->coeff[i] = 2.0f * cosf(2.0f * M_PI * bank->freq[i] / dec_rate);
+		} else {
+			bank->coeff[i] = 0.0f;
+		}
+		bank->s1[i] = 0.0f;
+		bank->s2[i] = 0.0f;
+		bank->present[i] = 0;
+		bank->level[i] = -90.0f;
+		bank->absent_run[i] = 0;
+		bank->since_gap[i] = 0;
+		bank->gaps[i] = 0;
+		bank->ident[i] = 0;
+	}
+
+	bank->dec_pos = 0;
+	bank->dec_sum = 0.0f;
+	bank->block_pos = 0;
+	bank->energy = 0.0f;
+	bank->blocks = 0;
+}
+
+
+/* Track interruptions of a tone, looking for the EBU stereo ident */
+static
+void tone_bank_ident( tone_bank_t *bank, int i, int present )
+{
+	const unsigned int gap_min = IDENT_GAP_MIN / TONE_WINDOW_MS;
+	const unsigned int gap_max = IDENT_GAP_MAX / TONE_WINDOW_MS;
+	const unsigned int period_min = IDENT_PERIOD_MIN / TONE_WINDOW_MS;
+	const unsigned int period_max = IDENT_PERIOD_MAX / TONE_WINDOW_MS;
+
+	if (present) {
+		// Did the tone just come back after an ident-sized gap?
+		if (bank->absent_run[i] >= gap_min && bank->absent_run[i] <= gap_max) {
+			if (bank->gaps[i] && bank->since_gap[i] >= period_min &&
+			    bank->since_gap[i] <= period_max) {
+				bank->gaps[i]++;
+			} else {
+				bank->gaps[i] = 1;
+			}
+			bank->since_gap[i] = 0;
+		}
+		bank->absent_run[i] = 0;
+	} else {
+		bank->absent_run[i]++;
+	}
+
+	// Forget about the pattern if the gaps stop coming
+	if (++bank->since_gap[i] > period_max + gap_max) {
+		bank->gaps[i] = 0;
+	}
+
+	bank->ident[i] = (bank->gaps[i] >= 2);
+}
+
+
+/* End of an analysis block: work out which tones were present */
+static
+void tone_bank_block( tone_bank_t *bank )
+{
+	const float n = bank->block_len;
+	int i;
+
+	// Counted before any tone in it, so the reader never sees more tones than blocks
+	__atomic_fetch_add( &bank->blocks, 1, __ATOMIC_RELEASE );
+
+	for (i = 0; i < bank->count; i++) {
+		const float power = bank->s1[i] * bank->s1[i] + bank->s2[i] * bank->s2[i]
+		                  - bank->coeff[i] * bank->s1[i] * bank->s2[i];
+		float ratio = 0.0f;
+		int present;
+
+		// Fraction of the total block energy that is in this tone
+		if (bank->energy > 0.0f) {
+			ratio = 2.0f * power / (n * bank->energy);
+		}
+		bank->level[i] = lin2db( 2.0f * sqrtf(power) / n );
+
+		present = (ratio >= TONE_RATIO && bank->level[i] >= TONE_MIN_LEVEL);
+		if (present) __atomic_fetch_add( &bank->present[i], 1, __ATOMIC_RELEASE );
+		tone_bank_ident( bank, i, present );
+	}
+
+	for (i = 0; i < TONE_MAX_FREQS; i++) {
+		bank->s1[i] = 0.0f;
+		bank->s2[i] = 0.0f;
+	}
+	bank->energy = 0.0f;
+	bank->block_pos = 0;
+}
+
+
+/* Feed a buffer of samples through the bank (called from process thread) */
+void tone_bank_process( tone_bank_t *bank, const float *in, unsigned int nframes )
+{
+	unsigned int n;
+	int i;
+
+	for (n = 0; n < nframes; n++) {
+		float x;
+
+		// Simple boxcar decimator
+		bank->dec_sum += in[n];
+		if (++bank->dec_pos < bank->decimate) continue;
+		x = bank->dec_sum / bank->decimate;
+		bank->dec_sum = 0.0f;
+		bank->dec_pos = 0;
+
+		bank->energy += x * x;
+		for (i = 0; i < TONE_MAX_FREQS; i++) {
+			const float s0 = x + bank->coeff[i] * bank->s1[i] - bank->s2[i];
+			bank->s2[i] = bank->s1[i];
+			bank->s1[i] = s0;
+		}
+
+		if (++bank->block_pos >= bank->block_len) {
+			tone_bank_block( bank );
+		}
+	}
+}
+
+
+/* Collect results since last call. A tone counts as present if it was
+   detected in at least half of the blocks. Returns number of blocks. */
+unsigned int tone_bank_read( tone_bank_t *bank, int *present, int *ident )
+{
+	unsigned int p[TONE_MAX_FREQS];
+	unsigned int blocks;
+	int i;
+
+	// Tones first: every block they were seen in has been counted by then
+	for (i = 0; i < bank->count; i++) {
+		p[i] = __atomic_exchange_n( &bank->present[i], 0, __ATOMIC_ACQ_REL );
+	}
+	blocks = __atomic_exchange_n( &bank->blocks, 0, __ATOMIC_ACQ_REL );
+
+	for (i = 0; i < bank->count; i++) {
+		present[i] = (blocks && p[i] * 2 >= blocks);
+		ident[i] = bank->ident[i];
+	}
+
+	return blocks;
+}
@@ -0,0 +1,68 @@
+/*
+
+	goertzel.h
+	Bank of Goertzel tone detectors for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef GOERTZEL_H
+#define GOERTZEL_H
+
+
+#define TONE_MAX_FREQS		8		// Maximum number of frequencies in a bank
+#define TONE_WINDOW_MS		50		// Length of each analysis block
+#define TONE_RATIO			0.7f	// Fraction of block energy needed in the tone
+#define TONE_MIN_LEVEL		-60.0f	// Tone must be at least this loud (in dB)
+
+
+/*
+	The bank runs all of its detectors side by side: each array below
+	is indexed by detector, so the per-sample update is a straight loop
+	over TONE_MAX_FREQS lanes that the compiler can vectorise.
+	Unused lanes have a zero coefficient and are simply ignored.
+*/
+typedef struct {
+	int count;							// Number of frequencies in use
+	float freq[TONE_MAX_FREQS];			// Frequency of each detector (Hz)
+	float coeff[TONE_MAX_FREQS];		// 2*cos(w) for each detector
+	float s1[TONE_MAX_FREQS];			// Goertzel state, one sample ago
+	float s2[TONE_MAX_FREQS];			// Goertzel state, two samples ago
+
+	unsigned int decimate;				// Input samples per decimated sample
+	unsigned int block_len;				// Decimated samples per analysis block
+	unsigned int dec_pos;				// Position within current decimation
+	unsigned int block_pos;				// Position within current block
+	float dec_sum;						// Running sum for the decimator
+	float energy;						// Sum of squares in current block
+
+	// Written by the process thread, collected by tone_bank_read()
+	unsigned int blocks;				// Blocks analysed since last read
+	unsigned int present[TONE_MAX_FREQS];	// Blocks in which tone was present
+	float level[TONE_MAX_FREQS];		// Level of tone in last block (dB)
+
+	// EBU stereo ident tracking (tone interrupted for 250ms every 3s)
+	unsigned int absent_run[TONE_MAX_FREQS];	// Blocks since tone disappeared
+	unsigned int since_gap[TONE_MAX_FREQS];		// Blocks since last ident gap
+	unsigned int gaps[TONE_MAX_FREQS];			// Consecutive periodic gaps
+	int ident[TONE_MAX_FREQS];					// True if ident pattern seen
+} tone_bank_t;
+
+
+int tone_bank_add( tone_bank_t *bank, float freq );
+void tone_bank_init( tone_bank_t *bank, unsigned int sample_rate );
+void tone_bank_process( tone_bank_t *bank, const float *in, unsigned int nframes );
+unsigned int tone_bank_read( tone_bank_t *bank, int *present, int *ident );
+
+
+#endif
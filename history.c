@@ -0,0 +1,467 @@
+/*
+
+	history.c
+	Multi-resolution level history for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "history.h"
+#include "db.h"
+
+
+// Length of a slot (ms) and of the ring (slots) at each level
+static const uint32_t resolution[HISTORY_LEVELS] = { 100, 1000, 60000, 3600000 };
+static const uint32_t length[HISTORY_LEVELS] = {
+	36000,		// 1 hour of 100ms
+	86400,		// 1 day of seconds
+	43200,		// 30 days of minutes
+	8784		// 1 year of hours
+};
+
+static char history_dir[1024] = "";
+static int64_t (*history_now)( void ) = NULL;	// Clock for new slots, NULL for the wall clock
+
+
+typedef struct {
+	float min;
+	float max;
+	double energy;				// Sum of power * milliseconds
+	int64_t ms;					// Milliseconds covered
+} totals_t;
+
+
+int history_init( const char* dir )
+{
+	if (strlen( dir ) >= sizeof(history_dir)) {
+		fprintf(stderr, "History directory path is too long: %s\n", dir);
+		return -1;
+	}
+	strcpy( history_dir, dir );
+	return 0;
+}
+
+
+int history_enabled( void )
+{
+	return history_dir[0] != '\0';
+}
+
+
+/* Take the time of new slots (ms since 1970) from clock instead of the
+   wall clock, such as a stream's own time when it is read faster */
+void history_clock( int64_t (*clock)( void ) )
+{
+	history_now = clock;
+}
+
+
+static
+int64_t now_ms( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static
+size_t layout( history_header_t *header, const char* port )
+{
+	size_t offset = 4096;
+	int i;
+
+	memset( header, 0, sizeof(history_header_t) );
+	header->magic = HISTORY_MAGIC;
+	header->version = HISTORY_VERSION;
+	header->levels = HISTORY_LEVELS;
+	header->slot_size = sizeof(history_slot_t);
+	for (i = 0; i < HISTORY_LEVELS; i++) {
+		header->resolution[i] = resolution[i];
+		header->length[i] = length[i];
+		header->offset[i] = offset;
+		offset += sizeof(history_slot_t) * length[i];
+	}
+	snprintf( header->port, sizeof(header->port), "%s", port );
+
+	return offset;
+}
+
+
+/* File for a port, with anything that can't go in a file name replaced */
+static
+void file_name( char *path, size_t len, const char* port )
+{
+	char *s;
+
+	snprintf( path, len, "%s/", history_dir );
+	s = path + strlen( path );
+	snprintf( s, len - (s - path), "%s.history", port );
+	for (; *s; s++) {
+		if (*s == '/') *s = '_';
+	}
+}
+
+
+static
+history_slot_t* ring( const history_header_t *file, int level )
+{
+	return (history_slot_t*)((char*)file + file->offset[level]);
+}
+
+
+/* Map the history file for a port, creating it if needed */
+static
+history_header_t* map_file( const char* port, int writable, size_t *size )
+{
+	char path[sizeof(history_dir) + 80];
+	history_header_t expected, *file;
+	struct stat st;
+	int fd, i;
+	uint32_t s;
+
+	*size = layout( &expected, port );
+	file_name( path, sizeof(path), port );
+
+	if ((fd = open( path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644 )) < 0) {
+		if (writable) perror( path );
+		return NULL;
+	}
+
+	// Start again if the file isn't laid out as we expect
+	if (fstat( fd, &st ) || (size_t)st.st_size != *size) {
+		if (!writable || ftruncate( fd, 0 ) || ftruncate( fd, *size )) {
+			if (writable) perror( path );
+			close( fd );
+			return NULL;
+		}
+	}
+
+	file = mmap( NULL, *size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+	             MAP_SHARED | (writable ? MAP_POPULATE : 0), fd, 0 );
+	close( fd );
+	if (file == MAP_FAILED) {
+		perror("history: mmap failed");
+		return NULL;
+	}
+
+	if (memcmp( file, &expected, offsetof(history_header_t, port) )) {
+		if (!writable) {
+			munmap( file, *size );
+			return NULL;
+		}
+		memcpy( file, &expected, sizeof(expected) );
+		for (i = 0; i < HISTORY_LEVELS; i++) {
+			for (s = 0; s < length[i]; s++) ring( file, i )[s].slot = -1;
+		}
+	}
+
+	return file;
+}
+
+
+int history_open( history_t *h, const char* port, unsigned int sample_rate )
+{
+	int i;
+
+	memset( h, 0, sizeof(history_t) );
+	if (!(h->file = map_file( port, 1, &h->size ))) return -1;
+
+	// Keep it all in memory, so storing slots never waits for the disk
+	if (mlock( h->file, h->size )) {
+		perror("history: mlock failed, history may wait for the disk");
+	}
+
+	h->slot_frames = sample_rate * resolution[0] / 1000;
+	h->current.slot = -1;
+	for (i = 0; i < HISTORY_LEVELS; i++) {
+		h->acc[i].slot = -1;
+	}
+
+	return 0;
+}
+
+
+/*
+	Write a finished slot into its ring, then roll it up into the next
+	level. If the ring already holds the same slot, written before a
+	restart (or by history_close()), the two are merged.
+*/
+static
+void finish_slot( history_t *h, int level, history_slot_t *acc )
+{
+	history_slot_t *slot = &ring( h->file, level )[ acc->slot % length[level] ];
+	history_slot_t *parent;
+	history_slot_t merged;
+	int64_t parent_slot;
+
+	// Coarser levels hold a sum of powers until they are finished
+	if (level > 0) acc->power /= acc->count;
+
+	merged = *acc;
+	if (slot->slot == acc->slot && slot->count) {
+		merged.count = acc->count + slot->count;
+		merged.power = (acc->power * acc->count + slot->power * slot->count) / merged.count;
+		if (slot->min < merged.min) merged.min = slot->min;
+		if (slot->max > merged.max) merged.max = slot->max;
+	}
+
+	// Readers check the slot number either side of reading
+	__atomic_store_n( &slot->slot, -1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+	slot->min = merged.min;
+	slot->max = merged.max;
+	slot->power = merged.power;
+	slot->count = merged.count;
+	__atomic_store_n( &slot->slot, merged.slot, __ATOMIC_RELEASE );
+
+	if (level + 1 >= HISTORY_LEVELS) return;
+
+	parent = &h->acc[level + 1];
+	parent_slot = acc->slot * resolution[level] / resolution[level + 1];
+	if (parent->count && parent->slot != parent_slot) {
+		finish_slot( h, level + 1, parent );
+		parent->count = 0;
+	}
+	if (parent->count == 0) {
+		parent->slot = parent_slot;
+		parent->min = acc->min;
+		parent->max = acc->max;
+		parent->power = 0.0f;
+	}
+	if (acc->min < parent->min) parent->min = acc->min;
+	if (acc->max > parent->max) parent->max = acc->max;
+	parent->power += acc->power;
+	parent->count++;
+}
+
+
+/* Called from the process thread with the peak and sum of squares of each block */
+void history_add( history_t *h, float peak, float sum_squares, unsigned int nframes )
+{
+	history_slot_t *acc = &h->current;
+	unsigned int head = h->head;
+	int64_t now;
+
+	if (!h->file) return;
+
+	if (acc->count == 0) {
+		if (acc->slot < 0) acc->slot = (history_now ? history_now() : now_ms()) / resolution[0];
+		acc->min = peak;
+		acc->max = peak;
+	}
+	if (peak < acc->min) acc->min = peak;
+	if (peak > acc->max) acc->max = peak;
+	h->sum_squares += sum_squares;
+	h->frames += nframes;
+	acc->count++;
+
+	if (h->frames < h->slot_frames) return;
+
+	// Queue the slot for the monitor thread; if it is that far behind, there is a gap
+	acc->power = h->sum_squares / h->frames;
+	if (head - __atomic_load_n( &h->tail, __ATOMIC_ACQUIRE ) < HISTORY_QUEUE) {
+		h->queue[ head % HISTORY_QUEUE ] = *acc;
+		__atomic_store_n( &h->head, head + 1, __ATOMIC_RELEASE );
+	}
+
+	// Follow the clock, in case we stopped being called for a while
+	now = (history_now ? history_now() : now_ms()) / resolution[0];
+	acc->slot = (now > acc->slot + 1) ? now : acc->slot + 1;
+	acc->count = 0;
+	h->frames = 0;
+	h->sum_squares = 0.0;
+}
+
+
+/* Called from the monitor thread: store the slots the process thread has finished */
+void history_flush( history_t *h )
+{
+	unsigned int head, tail = h->tail;
+	history_slot_t done;
+
+	if (!h->file) return;
+
+	head = __atomic_load_n( &h->head, __ATOMIC_ACQUIRE );
+	for (; tail != head; tail++) {
+		done = h->queue[ tail % HISTORY_QUEUE ];
+		__atomic_store_n( &h->tail, tail + 1, __ATOMIC_RELEASE );
+		finish_slot( h, 0, &done );
+	}
+}
+
+
+/* The process thread must no longer be able to see the history.
+   The coarse slots filled in so far are written, to be merged with
+   the rest of them if we start again within the same period. */
+void history_close( history_t *h )
+{
+	int i;
+
+	if (!h->file) return;
+	history_flush( h );
+	for (i = 1; i < HISTORY_LEVELS; i++) {
+		if (h->acc[i].count) finish_slot( h, i, &h->acc[i] );
+		h->acc[i].count = 0;
+	}
+	munmap( h->file, h->size );
+	h->file = NULL;
+}
+
+
+/* Add in one slot, if it is in the ring. Returns non-zero if it was. */
+static
+int add_slot( const history_header_t *file, int level, int64_t s, totals_t *t )
+{
+	const history_slot_t *slot = &ring( file, level )[ s % file->length[level] ];
+	history_slot_t copy;
+
+	if (__atomic_load_n( &slot->slot, __ATOMIC_ACQUIRE ) != s) return 0;
+	copy = *slot;
+	__atomic_thread_fence( __ATOMIC_ACQUIRE );
+	if (__atomic_load_n( &slot->slot, __ATOMIC_RELAXED ) != s) return 0;
+
+	if (t->ms == 0 || copy.min < t->min) t->min = copy.min;
+	if (t->ms == 0 || copy.max > t->max) t->max = copy.max;
+	t->energy += (double)copy.power * file->resolution[level];
+	t->ms += file->resolution[level];
+
+	return 1;
+}
+
+
+/* Add up [from, to) using slots of this level and finer */
+static
+void query_level( const history_header_t *file, int level, int64_t from, int64_t to, int64_t now, totals_t *t )
+{
+	const int64_t res = file->resolution[level];
+	int64_t first, last, s;
+
+	if (from >= to) return;
+
+	// The finest level takes any slot the range touches
+	if (level == 0) {
+		for (s = from / res; s * res < to; s++) add_slot( file, 0, s, t );
+		return;
+	}
+
+	// Whole slots of this level, with finer slots either side
+	first = (from + res - 1) / res;
+	last = to / res;
+	if (first >= last) {
+		query_level( file, level - 1, from, to, now, t );
+		return;
+	}
+
+	query_level( file, level - 1, from, first * res, now, t );
+	for (s = first; s < last; s++) {
+		// Slots not rolled up yet are only worth looking for in the finer
+		// level if it goes back that far
+		if (!add_slot( file, level, s, t ) &&
+		    (s + 1) * res > now - (int64_t)file->resolution[level - 1] * file->length[level - 1]) {
+			query_level( file, level - 1, s * res, (s + 1) * res, now, t );
+		}
+	}
+	query_level( file, level - 1, last * res, to, now, t );
+}
+
+
+/* Levels of a port between two times (ms since 1970). Returns non-zero
+   if there is no history for the port. */
+int history_query( const char* port, int64_t from_ms, int64_t to_ms, history_result_t *result )
+{
+	history_header_t *file;
+	totals_t t;
+	size_t size;
+
+	if (!history_enabled() || !(file = map_file( port, 0, &size ))) return -1;
+
+	memset( &t, 0, sizeof(t) );
+	query_level( file, HISTORY_LEVELS - 1, from_ms, to_ms, now_ms(), &t );
+	munmap( file, size );
+
+	result->min = lin2db( t.min );
+	result->max = lin2db( t.max );
+	result->rms = t.ms ? lin2db( sqrtf( t.energy / t.ms ) ) : -90.0f;
+	result->seconds = t.ms / 1000.0f;
+
+	return 0;
+}
+
+
+/* The level with slots of this length (ms), or -1 */
+int history_level( uint32_t res )
+{
+	int i;
+
+	for (i = 0; i < HISTORY_LEVELS; i++) {
+		if (resolution[i] == res) return i;
+	}
+	return -1;
+}
+
+
+/* Length of the slots of a level (ms) */
+uint32_t history_resolution( int level )
+{
+	return resolution[level];
+}
+
+
+/* Call fn for every slot of one level between two times (ms since 1970),
+   in order. Returns -1 if there is no history, or whatever fn returned
+   if it stopped early by returning non-zero. */
+int history_each( const char* port, int level, int64_t from_ms, int64_t to_ms,
+                  int (*fn)( void *arg, int64_t slot, const history_result_t *r ), void *arg )
+{
+	history_header_t *file;
+	history_result_t r;
+	int64_t s, first;
+	size_t size;
+	int result = 0;
+
+	if (level < 0 || level >= HISTORY_LEVELS ||
+	    !history_enabled() || !(file = map_file( port, 0, &size ))) return -1;
+
+	// Don't look further back than the ring goes
+	first = from_ms / resolution[level];
+	if (first < to_ms / resolution[level] - length[level]) {
+		first = to_ms / resolution[level] - length[level];
+	}
+
+	for (s = first; s * resolution[level] < to_ms && result == 0; s++) {
+		totals_t t;
+		memset( &t, 0, sizeof(t) );
+		if (!add_slot( file, level, s, &t )) continue;
+
+		r.min = lin2db( t.min );
+		r.max = lin2db( t.max );
+		r.rms = lin2db( sqrtf( t.energy / t.ms ) );
+		r.seconds = t.ms / 1000.0f;
+		result = fn( arg, s, &r );
+	}
+	munmap( file, size );
+
+	return result;
+}
@@ -0,0 +1,108 @@
+/*
+
+	history.h
+	Multi-resolution level history for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+
+#define HISTORY_MAGIC		0x534a484c	// 'SJHL'
+#define HISTORY_VERSION		1
+#define HISTORY_LEVELS		4			// 100ms, 1 second, 1 minute, 1 hour
+#define HISTORY_QUEUE		64			// Finished 100ms slots waiting to be stored
+
+
+/* Levels over one period. Min and max are of the block peaks (linear). */
+typedef struct {
+	int64_t slot;				// Time of slot, in units of the resolution (-1 while written)
+	float min;					// Lowest block peak
+	float max;					// Highest block peak
+	float power;				// Mean square of the samples
+	uint32_t count;				// Blocks (level 0) or finer slots rolled up
+} history_slot_t;
+
+/* Start of each file. The rings follow, finest first. */
+typedef struct {
+	uint32_t magic;				// HISTORY_MAGIC
+	uint32_t version;			// HISTORY_VERSION
+	uint32_t levels;			// HISTORY_LEVELS
+	uint32_t slot_size;			// sizeof(history_slot_t)
+	uint32_t resolution[HISTORY_LEVELS];	// Length of each slot (ms)
+	uint32_t length[HISTORY_LEVELS];		// Slots in each ring
+	uint64_t offset[HISTORY_LEVELS];		// Where each ring starts in the file
+	char port[64];				// Name of the port
+} history_header_t;
+
+typedef struct {
+	history_header_t *file;		// The mapped file
+	size_t size;				// Size of the mapping
+
+	// Used only by the process thread
+	unsigned int slot_frames;	// Frames in each level 0 slot
+	unsigned int frames;		// Frames in the current level 0 slot
+	history_slot_t current;		// Level 0 slot being filled in
+	double sum_squares;			// Sum of squares in current level 0 slot
+
+	// Finished level 0 slots, passed from the process thread to the monitor thread
+	history_slot_t queue[HISTORY_QUEUE];
+	unsigned int head;			// Written by the process thread
+	unsigned int tail;			// Written by the monitor thread
+
+	// Used only by the monitor thread
+	history_slot_t acc[HISTORY_LEVELS];	// Coarser slots being rolled up (from 1)
+} history_t;
+
+typedef struct {
+	float min;					// Lowest block peak (dB)
+	float max;					// Highest block peak (dB)
+	float rms;					// RMS level (dB)
+	float seconds;				// How much of the range there was history for
+} history_result_t;
+
+
+/*
+	History is kept in one file per port, in the directory given to
+	history_init(). Each resolution is a ring of slots, and the slot
+	for time t lives at (t / resolution) % length, so finding any time
+	is simple arithmetic. The process thread only adds up each 100ms
+	slot and queues it when it is finished. The monitor thread calls
+	history_flush() to store the queued slots straight into the mapped
+	file, rolling each one up into the next coarser slot as it goes, so
+	the process thread never touches the file, which could block it
+	while the kernel makes a page writable again after writeback.
+
+	A query uses the coarsest slots that fit within the range, and finer
+	slots only at the ends, so it reads at most a couple of hundred slots
+	plus one per hour of range.
+*/
+int history_init( const char* dir );
+int history_enabled( void );
+void history_clock( int64_t (*clock)( void ) );
+int history_open( history_t *h, const char* port, unsigned int sample_rate );
+void history_add( history_t *h, float peak, float sum_squares, unsigned int nframes );
+void history_flush( history_t *h );
+void history_close( history_t *h );
+int history_query( const char* port, int64_t from_ms, int64_t to_ms, history_result_t *result );
+int history_level( uint32_t resolution );
+uint32_t history_resolution( int level );
+int history_each( const char* port, int level, int64_t from_ms, int64_t to_ms,
+                  int (*fn)( void *arg, int64_t slot, const history_result_t *r ), void *arg );
+
+
+#endif
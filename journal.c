@@ -0,0 +1,317 @@
+/*
+
+	journal.c
+	Durable journal of detector state for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "journal.h"
+
+
+static char path[1024];					// Name of the journal
+static char tmp_path[sizeof(path) + 8];	// Name of the next journal, while it is written
+static int fd = -1;
+static pthread_t thread;
+static int running = 0;
+
+// Records waiting to be committed, protected by pending_lock
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static char pending[JOURNAL_BUFFER];
+static size_t pending_len = 0;
+static long pending_checkpoint = -1;	// Offset of a checkpoint in pending, or -1
+
+// Only used by the writer thread
+static char batch[JOURNAL_BUFFER];
+
+
+/* CRC-32 (IEEE 802.3), as used by zlib */
+static
+uint32_t crc32( uint32_t crc, const unsigned char *data, size_t len )
+{
+	static uint32_t table[256];
+	static int ready = 0;
+	size_t i;
+
+	if (!ready) {
+		uint32_t c;
+		int n, k;
+		for (n = 0; n < 256; n++) {
+			c = n;
+			for (k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		ready = 1;
+	}
+
+	crc = ~crc;
+	for (i = 0; i < len; i++) {
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+
+/* True if the state has changed in a way worth writing down: something
+   started or stopped counting, or an alarm, event or command happened */
+int journal_changed( const journal_state_t *a, const journal_state_t *b )
+{
+	int i;
+
+	if (strcmp( a->port, b->port ) || a->alarm_start != b->alarm_start ||
+	    (a->silence_count > 0) != (b->silence_count > 0) ||
+	    (a->nodynamic_count > 0) != (b->nodynamic_count > 0) ||
+	    (a->in_grace > 0) != (b->in_grace > 0) ||
+	    (a->noise_count > 0) != (b->noise_count > 0) ||
+	    (a->loop_count > 0) != (b->loop_count > 0) ||
+	    (a->mismatch_count > 0) != (b->mismatch_count > 0) ||
+	    a->commands != b->commands ||
+	    memcmp( a->events, b->events, sizeof(a->events) )) {
+		return 1;
+	}
+	for (i = 0; i < JOURNAL_TONES; i++) {
+		if ((a->tone_count[i] > 0) != (b->tone_count[i] > 0)) return 1;
+	}
+
+	return 0;
+}
+
+
+int journal_replay( const char* file, journal_state_t *states, int max, int64_t *last )
+{
+	FILE *f = fopen( file, "r" );
+	journal_state_t record[JOURNAL_MAX_PORTS];
+	journal_header_t header;
+	int count = 0, i, j;
+
+	*last = 0;
+	if (!f) return 0;
+
+	while (fread( &header, sizeof(header), 1, f ) == 1) {
+		const size_t len = sizeof(journal_state_t) * header.count;
+		uint32_t crc;
+
+		if (header.magic != JOURNAL_MAGIC || header.count > JOURNAL_MAX_PORTS ||
+		    (header.type != JOURNAL_CHECKPOINT && header.type != JOURNAL_UPDATE) ||
+		    fread( record, 1, len, f ) != len) {
+			break;
+		}
+		crc = crc32( 0, (const unsigned char*)&header.type, sizeof(header) - offsetof(journal_header_t, type) );
+		crc = crc32( crc, (const unsigned char*)record, len );
+		if (crc != header.crc) break;
+
+		if (header.type == JOURNAL_CHECKPOINT) count = 0;
+		for (i = 0; i < header.count; i++) {
+			record[i].port[sizeof(record[i].port) - 1] = '\0';
+			for (j = 0; j < count && strcmp( states[j].port, record[i].port ); j++);
+			if (j == count) {
+				if (count >= max) continue;
+				count++;
+			}
+			states[j] = record[i];
+			if (record[i].time > *last) *last = record[i].time;
+		}
+	}
+
+	if (!feof( f )) {
+		fprintf(stderr, "%s: ignoring damaged journal after %ld bytes\n", file, ftell( f ));
+	}
+	fclose( f );
+
+	return count;
+}
+
+
+static
+int write_all( int to, const char* data, size_t len )
+{
+	while (len) {
+		ssize_t n = write( to, data, len );
+		if (n <= 0) {
+			perror("journal: write failed");
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+/* Make sure a rename in the journal's directory is on disk */
+static
+void sync_directory( void )
+{
+	char dir[sizeof(path)];
+	char *slash;
+	int dfd;
+
+	strcpy( dir, path );
+	if ((slash = strrchr( dir, '/' ))) {
+		slash[1] = '\0';
+	} else {
+		strcpy( dir, "." );
+	}
+
+	if ((dfd = open( dir, O_RDONLY )) >= 0) {
+		fsync( dfd );
+		close( dfd );
+	}
+}
+
+
+/* Write a batch of records: anything before a checkpoint goes on the
+   end of the old journal, the checkpoint and what follows starts the new one */
+static
+void commit( size_t len, long checkpoint )
+{
+	int next;
+
+	if (checkpoint < 0) {
+		if (write_all( fd, batch, len ) == 0) fdatasync( fd );
+		return;
+	}
+
+	if (checkpoint > 0 && write_all( fd, batch, checkpoint ) == 0) fdatasync( fd );
+
+	// If the new journal can't be made, the checkpoint goes on the end of the old one
+	if ((next = open( tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644 )) < 0) {
+		perror( tmp_path );
+		if (write_all( fd, batch + checkpoint, len - checkpoint ) == 0) fdatasync( fd );
+		return;
+	}
+	if (write_all( next, batch + checkpoint, len - checkpoint ) || fsync( next ) ||
+	    rename( tmp_path, path )) {
+		perror("journal: failed to write checkpoint");
+		close( next );
+		unlink( tmp_path );
+		if (write_all( fd, batch + checkpoint, len - checkpoint ) == 0) fdatasync( fd );
+		return;
+	}
+	sync_directory();
+
+	close( fd );
+	fd = next;
+}
+
+
+static
+void* journal_thread( void *arg )
+{
+	int stopping = 0;
+
+	while (!stopping) {
+		size_t len;
+		long checkpoint;
+
+		stopping = !__atomic_load_n( &running, __ATOMIC_ACQUIRE );
+		if (!stopping) usleep( JOURNAL_COMMIT_MS * 1000 );
+
+		// Take everything that is waiting, then commit it without the lock
+		pthread_mutex_lock( &pending_lock );
+		len = pending_len;
+		checkpoint = pending_checkpoint;
+		memcpy( batch, pending, len );
+		pending_len = 0;
+		pending_checkpoint = -1;
+		pthread_mutex_unlock( &pending_lock );
+
+		if (len) commit( len, checkpoint );
+	}
+
+	return NULL;
+}
+
+
+int journal_start( const char* file )
+{
+	if (strlen( file ) >= sizeof(path)) {
+		fprintf(stderr, "Journal path is too long: %s\n", file);
+		return -1;
+	}
+	strcpy( path, file );
+	snprintf( tmp_path, sizeof(tmp_path), "%s.new", path );
+
+	if ((fd = open( path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 )) < 0) {
+		perror( path );
+		return -1;
+	}
+
+	running = 1;
+	if (pthread_create( &thread, NULL, journal_thread, NULL )) {
+		fprintf(stderr, "journal_start(): failed to start journal thread.\n");
+		running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*
+	Queue a record. The first record after starting should be a
+	checkpoint, so that anything damaged in the old journal is left
+	behind. Returns non-zero if the record didn't fit, in which case
+	the next record should be a checkpoint too.
+*/
+int journal_append( int type, const journal_state_t *states, int count )
+{
+	const size_t len = sizeof(journal_header_t) + sizeof(journal_state_t) * count;
+	journal_header_t header;
+	uint32_t crc;
+	int result = 0;
+
+	if (!running) return 0;
+
+	header.magic = JOURNAL_MAGIC;
+	header.type = type;
+	header.count = count;
+	crc = crc32( 0, (const unsigned char*)&header.type, sizeof(header) - offsetof(journal_header_t, type) );
+	header.crc = crc32( crc, (const unsigned char*)states, sizeof(journal_state_t) * count );
+
+	pthread_mutex_lock( &pending_lock );
+	if (pending_len + len > sizeof(pending)) {
+		result = -1;
+	} else {
+		if (type == JOURNAL_CHECKPOINT && pending_checkpoint < 0) {
+			pending_checkpoint = pending_len;
+		}
+		memcpy( pending + pending_len, &header, sizeof(header) );
+		memcpy( pending + pending_len + sizeof(header), states, sizeof(journal_state_t) * count );
+		pending_len += len;
+	}
+	pthread_mutex_unlock( &pending_lock );
+
+	return result;
+}
+
+
+void journal_finish( void )
+{
+	if (!running) return;
+
+	// The writer thread commits what is left before stopping
+	__atomic_store_n( &running, 0, __ATOMIC_RELEASE );
+	pthread_join( thread, NULL );
+
+	close( fd );
+	fd = -1;
+}
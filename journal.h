@@ -0,0 +1,84 @@
+/*
+
+	journal.h
+	Durable journal of detector state for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+
+#define JOURNAL_MAGIC			0x534a4a31	// 'SJJ1'
+#define JOURNAL_MAX_PORTS		64
+#define JOURNAL_COMMIT_MS		500			// Group commit interval
+#define JOURNAL_CHECKPOINT_SECS	60			// Time between checkpoints
+#define JOURNAL_BUFFER			(256 * 1024)	// Records waiting to be committed
+#define JOURNAL_TONES			8			// Tone counts in a state (TONE_MAX_FREQS)
+#define JOURNAL_EVENTS			16			// Event counts in a state (at least EVENT_TYPES)
+
+enum {
+	JOURNAL_CHECKPOINT = 1,		// State of every port, replaces everything before
+	JOURNAL_UPDATE = 2			// State of some ports
+};
+
+
+/* State of one port at a point in time */
+typedef struct {
+	char port[64];				// Name of the port
+	int64_t time;				// When this was the state (seconds since 1970)
+	int64_t alarm_start;		// When the current alarm started (0 if none)
+	int32_t silence_count;
+	int32_t nodynamic_count;
+	int32_t in_grace;
+	int32_t noise_count;
+	int32_t loop_count;
+	int32_t mismatch_count;
+	int32_t tone_count[JOURNAL_TONES];
+	uint64_t seconds;
+	uint64_t commands;
+	uint64_t events[JOURNAL_EVENTS];
+} journal_state_t;
+
+/* Every record starts with this, followed by 'count' states */
+typedef struct {
+	uint32_t magic;				// JOURNAL_MAGIC
+	uint32_t crc;				// CRC-32 of everything after this field
+	uint16_t type;				// JOURNAL_CHECKPOINT or JOURNAL_UPDATE
+	uint16_t count;				// Number of states that follow
+} journal_header_t;
+
+
+/*
+	The journal is append-only. Records are collected in memory and
+	committed by a writer thread at most every JOURNAL_COMMIT_MS, with
+	one write and one fdatasync for the whole batch, however many
+	records there are. A checkpoint starts a new file, which replaces
+	the old one once it is safely on disk, so the journal stays small.
+
+	journal_replay() reads the latest state of each port back, stopping
+	at the first damaged record (such as one torn by a crash), and
+	returns the number of ports. *last is set to the time of the most
+	recent record.
+*/
+int journal_replay( const char* path, journal_state_t *states, int max, int64_t *last );
+int journal_start( const char* path );
+int journal_append( int type, const journal_state_t *states, int count );
+void journal_finish( void );
+int journal_changed( const journal_state_t *a, const journal_state_t *b );
+
+
+#endif
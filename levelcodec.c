@@ -0,0 +1,251 @@
+/*
+
+	levelcodec.c
+	Compact encoding of level series for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "levelcodec.h"
+
+
+static
+int put_byte( level_buffer_t *b, unsigned char c )
+{
+	if (b->len == b->size) {
+		size_t size = b->size ? b->size * 2 : 4096;
+		unsigned char *data = realloc( b->data, size );
+		if (!data) {
+			perror("levelcodec: realloc failed");
+			return -1;
+		}
+		b->data = data;
+		b->size = size;
+	}
+	b->data[ b->len++ ] = c;
+	return 0;
+}
+
+
+static
+int put_varint( level_buffer_t *b, uint64_t v )
+{
+	while (v >= 0x80) {
+		if (put_byte( b, (v & 0x7f) | 0x80 )) return -1;
+		v >>= 7;
+	}
+	return put_byte( b, v );
+}
+
+
+static
+int put_buffer( level_buffer_t *b, const unsigned char *data, size_t len )
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (put_byte( b, data[i] )) return -1;
+	}
+	return 0;
+}
+
+
+static
+uint64_t zigzag( int64_t v )
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+
+static
+int64_t unzigzag( uint64_t v )
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+
+/* Tenths of a dB */
+static
+int quantise( float db )
+{
+	return lrintf( db * 10.0f );
+}
+
+
+int level_write_header( FILE *file )
+{
+	unsigned char version = LEVELCODEC_VERSION;
+
+	if (fwrite( LEVELCODEC_MAGIC, 4, 1, file ) != 1 || fwrite( &version, 1, 1, file ) != 1) {
+		perror("level_write_header(): write failed");
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Start a block for a port */
+int level_encoder_begin( level_encoder_t *enc, const char* port, uint32_t resolution, int64_t first_slot )
+{
+	size_t len = strlen( port );
+
+	if (len >= LEVELCODEC_NAME_MAX) len = LEVELCODEC_NAME_MAX - 1;
+	enc->pending.len = 0;
+	enc->run = 0;
+	enc->skip = 0;
+	enc->next_slot = first_slot;
+	memset( enc->last, 0, sizeof(enc->last) );
+
+	return put_varint( &enc->out, len ) ||
+	       put_buffer( &enc->out, (const unsigned char*)port, len ) ||
+	       put_varint( &enc->out, resolution ) ||
+	       put_varint( &enc->out, zigzag( first_slot ) );
+}
+
+
+static
+int end_run( level_encoder_t *enc )
+{
+	if (enc->run == 0) return 0;
+
+	if (put_varint( &enc->out, enc->skip ) ||
+	    put_varint( &enc->out, enc->run ) ||
+	    put_buffer( &enc->out, enc->pending.data, enc->pending.len )) {
+		return -1;
+	}
+	enc->pending.len = 0;
+	enc->run = 0;
+	enc->skip = 0;
+	return 0;
+}
+
+
+/* Add the next level. Slots must be in order. */
+int level_encoder_add( level_encoder_t *enc, const level_t *level )
+{
+	const int q[3] = { quantise( level->min ), quantise( level->max ), quantise( level->rms ) };
+	int i;
+
+	if (level->slot < enc->next_slot) return -1;
+
+	// A gap ends the run
+	if (level->slot != enc->next_slot) {
+		if (end_run( enc )) return -1;
+		enc->skip = level->slot - enc->next_slot;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (put_varint( &enc->pending, zigzag( q[i] - enc->last[i] ) )) return -1;
+		enc->last[i] = q[i];
+	}
+	enc->run++;
+	enc->next_slot = level->slot + 1;
+
+	return 0;
+}
+
+
+/* Finish the block */
+int level_encoder_end( level_encoder_t *enc )
+{
+	return end_run( enc ) || put_varint( &enc->out, 0 ) || put_varint( &enc->out, 0 );
+}
+
+
+void level_encoder_free( level_encoder_t *enc )
+{
+	free( enc->out.data );
+	free( enc->pending.data );
+	memset( enc, 0, sizeof(level_encoder_t) );
+}
+
+
+static
+int get_varint( level_decoder_t *dec, uint64_t *v )
+{
+	int shift = 0, c;
+
+	*v = 0;
+	while ((c = getc( dec->file )) != EOF) {
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return 0;
+		if ((shift += 7) > 63) return -1;
+	}
+	return -1;
+}
+
+
+int level_decoder_open( level_decoder_t *dec, FILE *file )
+{
+	char magic[4];
+	int version;
+
+	memset( dec, 0, sizeof(level_decoder_t) );
+	dec->file = file;
+
+	if (fread( magic, 4, 1, file ) != 1 || memcmp( magic, LEVELCODEC_MAGIC, 4 ) ||
+	    (version = getc( file )) != LEVELCODEC_VERSION) {
+		fprintf(stderr, "Not a version %d level export.\n", LEVELCODEC_VERSION);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Read the next level, a slot at a time. Returns 1 if there is one,
+   0 at the end of the file, or -1 if the file is damaged. */
+int level_decoder_next( level_decoder_t *dec, level_t *level )
+{
+	uint64_t v, skip;
+	int i;
+
+	while (dec->run == 0) {
+		if (!dec->in_block) {
+			// Start of the next block, or the end of the file
+			int c = getc( dec->file );
+			if (c == EOF) return 0;
+			ungetc( c, dec->file );
+
+			if (get_varint( dec, &v ) || v >= LEVELCODEC_NAME_MAX ||
+			    fread( dec->port, 1, v, dec->file ) != v) return -1;
+			dec->port[v] = '\0';
+			if (get_varint( dec, &v )) return -1;
+			dec->resolution = v;
+			if (get_varint( dec, &v )) return -1;
+			dec->slot = unzigzag( v );
+			memset( dec->last, 0, sizeof(dec->last) );
+			dec->in_block = 1;
+		}
+
+		if (get_varint( dec, &skip ) || get_varint( dec, &dec->run )) return -1;
+		if (dec->run == 0) dec->in_block = 0;
+		dec->slot += skip;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (get_varint( dec, &v )) return -1;
+		dec->last[i] += unzigzag( v );
+	}
+	level->slot = dec->slot++;
+	level->min = dec->last[0] / 10.0f;
+	level->max = dec->last[1] / 10.0f;
+	level->rms = dec->last[2] / 10.0f;
+	dec->run--;
+
+	return 1;
+}
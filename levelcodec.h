@@ -0,0 +1,87 @@
+/*
+
+	levelcodec.h
+	Compact encoding of level series for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef LEVELCODEC_H
+#define LEVELCODEC_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+#define LEVELCODEC_MAGIC		"SJLX"
+#define LEVELCODEC_VERSION		1
+#define LEVELCODEC_NAME_MAX		64
+
+
+/*
+	A file is the magic and version, followed by one block per port:
+
+	  name length, name, resolution (ms), first slot
+	  then runs of consecutive slots: slots skipped since the last run,
+	  run length, and for each slot the change in min, max and RMS
+	  ending with a run of length zero
+
+	Levels are in tenths of a dB. Every number is a varint (7 bits a
+	byte, least significant first); changes are zigzag encoded so small
+	changes either way take one byte.
+*/
+
+typedef struct {
+	int64_t slot;				// Time, in units of the resolution
+	float min;					// Lowest block peak (dB)
+	float max;					// Highest block peak (dB)
+	float rms;					// RMS level (dB)
+} level_t;
+
+typedef struct {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+} level_buffer_t;
+
+typedef struct {
+	level_buffer_t out;			// Encoded blocks
+	level_buffer_t pending;		// Changes in the current run
+	uint64_t run;				// Slots in the current run
+	uint64_t skip;				// Slots skipped before the current run
+	int64_t next_slot;			// Slot expected next if the run continues
+	int last[3];				// Previous quantised levels
+} level_encoder_t;
+
+typedef struct {
+	FILE *file;
+	char port[LEVELCODEC_NAME_MAX];	// Port of the current block
+	uint32_t resolution;			// Resolution of the current block (ms)
+	int64_t slot;					// Slot of the next level
+	int in_block;					// True part way through a block
+	uint64_t run;					// Levels left in the current run
+	int last[3];					// Previous quantised levels
+} level_decoder_t;
+
+
+int level_encoder_begin( level_encoder_t *enc, const char* port, uint32_t resolution, int64_t first_slot );
+int level_encoder_add( level_encoder_t *enc, const level_t *level );
+int level_encoder_end( level_encoder_t *enc );
+void level_encoder_free( level_encoder_t *enc );
+int level_write_header( FILE *file );
+
+int level_decoder_open( level_decoder_t *dec, FILE *file );
+int level_decoder_next( level_decoder_t *dec, level_t *level );
+
+
+#endif
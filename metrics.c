@@ -0,0 +1,339 @@
+/*
+
+	metrics.c
+	Prometheus metrics exporter for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "status.h"
+
+
+static int listen_fd = -1;
+static pthread_t thread;
+static int running = 0;
+
+// Only used by the metrics thread
+static snapshot_t snap;									// Copy of the status being rendered
+static char page[METRICS_PAGE_MAX];						// Rendered metrics
+static int page_len = 0;
+static char label_port[RULES_MAX][RULE_NAME_MAX];		// Port each label was made for
+static char label[RULES_MAX][RULE_NAME_MAX * 2 + 8];	// port="..." for each port
+
+
+static
+void emit( const char* fmt, ... )
+{
+	va_list args;
+	int n;
+
+	if (page_len >= METRICS_PAGE_MAX - 1) return;
+
+	va_start( args, fmt );
+	n = vsnprintf( page + page_len, METRICS_PAGE_MAX - page_len, fmt, args );
+	va_end( args );
+
+	if (n > 0) page_len += n;
+	if (page_len > METRICS_PAGE_MAX - 1) page_len = METRICS_PAGE_MAX - 1;
+}
+
+
+static
+void family( const char* name, const char* type, const char* help )
+{
+	emit( "# HELP silentjack_%s %s\n# TYPE silentjack_%s %s\n", name, help, name, type );
+}
+
+
+/* Format the port labels again only when the ports change */
+static
+void update_labels( void )
+{
+	int i;
+
+	for (i = 0; i < snap.count; i++) {
+		const char* s = snap.status[i].port;
+		char *d = label[i];
+
+		if (strcmp( label_port[i], s ) == 0) continue;
+		strcpy( label_port[i], s );
+
+		d += sprintf( d, "port=\"" );
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\') *d++ = '\\';
+			*d++ = *s;
+		}
+		strcpy( d, "\"" );
+	}
+}
+
+
+static
+void render( void )
+{
+	const engine_status_t *e = &snap.engine;
+	unsigned long total;
+	int i, j;
+
+	status_snapshot( &snap );
+	update_labels();
+	page_len = 0;
+
+	family( "up", "gauge", "Whether the port is connected to anything." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_up{%s} %d\n", label[i], snap.status[i].connected ? 1 : 0 );
+
+	family( "peak_dbfs", "gauge", "Peak level in the last second." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_peak_dbfs{%s} %.2f\n", label[i], snap.status[i].peakdb );
+
+	family( "rms_dbfs", "gauge", "RMS level in the last second." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_rms_dbfs{%s} %.2f\n", label[i], snap.status[i].rmsdb );
+
+	family( "threshold_dbfs", "gauge", "Silence threshold in use." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_threshold_dbfs{%s} %.2f\n", label[i], snap.status[i].threshold );
+
+	family( "silence_seconds", "gauge", "Length of the current silence." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_silence_seconds{%s} %d\n", label[i], snap.status[i].silence_count );
+
+	family( "grace_seconds", "gauge", "Time left in the grace period." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_grace_seconds{%s} %d\n", label[i], snap.status[i].in_grace );
+
+	family( "monitored_seconds_total", "counter", "Seconds of audio monitored." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_monitored_seconds_total{%s} %lu\n", label[i], snap.status[i].seconds );
+
+	family( "events_total", "counter", "Number of times each event was triggered." );
+	for (i = 0; i < snap.count; i++) {
+		for (j = 0; j < EVENT_TYPES; j++) {
+			emit( "silentjack_events_total{%s,event=\"%s\"} %lu\n",
+				label[i], event_names[j], snap.status[i].events[j] );
+		}
+	}
+
+	family( "commands_total", "counter", "Number of commands run." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_commands_total{%s} %lu\n", label[i], snap.status[i].commands );
+
+	family( "analysis_dropped_frames_total", "counter", "Frames not analysed because the analysis threads fell behind." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_analysis_dropped_frames_total{%s} %lu\n", label[i], snap.status[i].analysis_dropped );
+
+	family( "analysis_overruns_total", "counter", "Process callbacks whose audio didn't fit in the analysis buffer." );
+	for (i = 0; i < snap.count; i++)
+		emit( "silentjack_analysis_overruns_total{%s} %lu\n", label[i], snap.status[i].analysis_overruns );
+
+	family( "xruns_total", "counter", "Number of xruns reported by JACK." );
+	emit( "silentjack_xruns_total %lu\n", e->xruns );
+
+	family( "engine_stalled", "gauge", "Whether JACK has stopped calling the process callback." );
+	emit( "silentjack_engine_stalled %d\n", e->stalled ? 1 : 0 );
+
+	family( "engine_stalls_total", "counter", "Number of times JACK has stalled." );
+	emit( "silentjack_engine_stalls_total %lu\n", e->stalls );
+
+	family( "server_connected", "gauge", "Whether SilentJack is connected to the JACK server." );
+	emit( "silentjack_server_connected %d\n", e->disconnected ? 0 : 1 );
+
+	family( "server_outages_total", "counter", "Number of times the JACK server has gone away." );
+	emit( "silentjack_server_outages_total %lu\n", e->outages );
+
+	family( "eventlog_dropped_total", "counter", "Number of events the event log had no room for." );
+	emit( "silentjack_eventlog_dropped_total %lu\n", e->eventlog_dropped );
+
+	family( "cpu_load_percent", "gauge", "JACK DSP load." );
+	emit( "silentjack_cpu_load_percent %.2f\n", e->cpu_load );
+
+	family( "buffer_size_frames", "gauge", "Frames per JACK process callback." );
+	emit( "silentjack_buffer_size_frames %u\n", e->buffer_size );
+
+	family( "sample_rate_hertz", "gauge", "JACK sample rate." );
+	emit( "silentjack_sample_rate_hertz %u\n", e->sample_rate );
+
+	family( "callback_quantile_seconds", "gauge", "Process callback time below which a fraction of callbacks fall." );
+	emit( "silentjack_callback_quantile_seconds{quantile=\"0.5\"} %.7f\n", engine_percentile( e, 50.0f ) * 1e-9 );
+	emit( "silentjack_callback_quantile_seconds{quantile=\"0.99\"} %.7f\n", engine_percentile( e, 99.0f ) * 1e-9 );
+	emit( "silentjack_callback_quantile_seconds{quantile=\"0.999\"} %.7f\n", engine_percentile( e, 99.9f ) * 1e-9 );
+	emit( "silentjack_callback_quantile_seconds{quantile=\"1\"} %.7f\n", e->max_nanoseconds * 1e-9 );
+
+	family( "callback_seconds", "histogram", "Time spent in the JACK process callback." );
+	for (i = 0; i < TIMING_BOUNDS; i++) {
+		const unsigned long long edge = timing_bucket_edge( timing_bounds[i] * 1e9 + 0.5 );
+		emit( "silentjack_callback_seconds_bucket{le=\"%.9g\"} %lu\n", edge * 1e-9,
+			engine_count_below( e, edge ) );
+	}
+
+	// The total comes from the same buckets, so it can't be less than any of them
+	total = engine_count_below( e, ~0ULL );
+	emit( "silentjack_callback_seconds_bucket{le=\"+Inf\"} %lu\n", total );
+	emit( "silentjack_callback_seconds_sum %.6f\n", e->nanoseconds * 1e-9 );
+	emit( "silentjack_callback_seconds_count %lu\n", total );
+}
+
+
+static
+void send_all( int fd, const char* data, size_t len )
+{
+	while (len) {
+		ssize_t n = send( fd, data, len, MSG_NOSIGNAL );
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return;
+		data += n;
+		len -= n;
+	}
+}
+
+
+/* Answer a single request and close the connection */
+static
+void serve( int fd )
+{
+	const struct timeval timeout = { 1, 0 };
+	char request[METRICS_REQUEST_MAX];
+	char header[256];
+	size_t len = 0;
+
+	// Don't let a slow client hold up everyone else for long
+	setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+	setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );
+
+	while (len < sizeof(request) - 1) {
+		ssize_t n = recv( fd, request + len, sizeof(request) - len - 1, 0 );
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		len += n;
+		request[len] = '\0';
+		if (strstr( request, "\r\n\r\n" ) || strstr( request, "\n\n" )) break;
+	}
+	request[len] = '\0';
+
+	if (strncmp( request, "GET /metrics ", 13 ) == 0 || strncmp( request, "GET / ", 6 ) == 0) {
+		render();
+		snprintf( header, sizeof(header),
+			"HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %d\r\n"
+			"Connection: close\r\n\r\n", page_len );
+		send_all( fd, header, strlen( header ) );
+		send_all( fd, page, page_len );
+	} else if (len) {
+		const char* missing =
+			"HTTP/1.0 404 Not Found\r\n"
+			"Content-Type: text/plain\r\n"
+			"Connection: close\r\n\r\n"
+			"Try /metrics\n";
+		send_all( fd, missing, strlen( missing ) );
+	}
+
+	close( fd );
+}
+
+
+static
+void* metrics_thread( void *arg )
+{
+	struct pollfd pfd;
+
+	while (running) {
+		pfd.fd = listen_fd;
+		pfd.events = POLLIN;
+
+		// Wake up regularly to check if we should still be running
+		if (poll( &pfd, 1, 250 ) > 0 && (pfd.revents & POLLIN)) {
+			int fd = accept( listen_fd, NULL, NULL );
+			if (fd >= 0) serve( fd );
+		}
+	}
+
+	return NULL;
+}
+
+
+int metrics_start( const char* address )
+{
+	struct sockaddr_in addr;
+	char host[64] = METRICS_DEFAULT_HOST;
+	const char* colon = strrchr( address, ':' );
+	const char* port = colon ? colon + 1 : address;
+	const int on = 1;
+
+	if (colon) {
+		if (colon - address >= (int)sizeof(host)) {
+			fprintf(stderr, "Invalid metrics address: %s\n", address);
+			return -1;
+		}
+		memcpy( host, address, colon - address );
+		host[colon - address] = '\0';
+	}
+
+	memset( &addr, 0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( atoi( port ) );
+	if (atoi( port ) <= 0 || inet_pton( AF_INET, host, &addr.sin_addr ) != 1) {
+		fprintf(stderr, "Invalid metrics address: %s\n", address);
+		return -1;
+	}
+
+	if ((listen_fd = socket( AF_INET, SOCK_STREAM, 0 )) < 0) {
+		perror("metrics_start(): socket failed");
+		return -1;
+	}
+
+	setsockopt( listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+	if (bind( listen_fd, (struct sockaddr*)&addr, sizeof(addr) ) ||
+	    listen( listen_fd, 8 )) {
+		perror("metrics_start(): failed to bind metrics socket");
+		close( listen_fd );
+		listen_fd = -1;
+		return -1;
+	}
+
+	running = 1;
+	if (pthread_create( &thread, NULL, metrics_thread, NULL )) {
+		fprintf(stderr, "metrics_start(): failed to start metrics thread.\n");
+		running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void metrics_finish( void )
+{
+	if (!running) return;
+	running = 0;
+	pthread_join( thread, NULL );
+
+	close( listen_fd );
+	listen_fd = -1;
+}
@@ -0,0 +1,39 @@
+/*
+
+	metrics.h
+	Prometheus metrics exporter for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+
+#define METRICS_DEFAULT_HOST	"127.0.0.1"
+#define METRICS_REQUEST_MAX		2048		// Longest HTTP request accepted
+#define METRICS_PAGE_MAX		262144		// Largest page of metrics
+
+
+/*
+	A minimal HTTP server, on its own thread, answering GET /metrics
+	in the Prometheus text format. Each scrape renders the latest
+	status snapshot into a static buffer, so scrapes never allocate
+	and only hold the snapshot lock long enough to copy it.
+	The address is '[host:]port', on localhost unless a host is given.
+*/
+int metrics_start( const char* address );
+void metrics_finish( void );
+
+
+#endif
@@ -0,0 +1,112 @@
+/*
+
+	noisefloor.c
+	Adaptive noise floor tracking for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "noisefloor.h"
+#include "db.h"
+
+
+void noisefloor_init( noisefloor_t *nf )
+{
+	memset( nf->recent, 0, sizeof(nf->recent) );
+	memset( nf->hist, 0, sizeof(nf->hist) );
+	nf->total = 0.0f;
+	nf->decay = expf( -1.0f / NF_MEMORY_SECS );
+	nf->learnt = 0;
+	nf->floor = NF_MIN_DB;
+	nf->median = NF_MIN_DB;
+}
+
+
+/* Record the peak of one block (called from process thread) */
+void noisefloor_add( noisefloor_t *nf, float peak )
+{
+	int b = (lin2db( peak ) - NF_MIN_DB) / NF_STEP_DB;
+
+	if (b < 0) b = 0;
+	if (b >= NF_BUCKETS) b = NF_BUCKETS - 1;
+	__atomic_add_fetch( &nf->recent[b], 1, __ATOMIC_RELAXED );
+}
+
+
+/* Level below which the given fraction of the histogram lies */
+static
+float noisefloor_quantile( noisefloor_t *nf, float q )
+{
+	const float target = q * nf->total;
+	float sum = 0.0f;
+	int b;
+
+	for (b = 0; b < NF_BUCKETS; b++) {
+		sum += nf->hist[b];
+		if (sum >= target) break;
+	}
+
+	return NF_MIN_DB + (b + 0.5f) * NF_STEP_DB;
+}
+
+
+/* Called once a second by the monitor thread. If learn is false the
+   last second's blocks are discarded rather than learnt from. */
+void noisefloor_update( noisefloor_t *nf, int learn )
+{
+	unsigned int counts[NF_BUCKETS];
+	unsigned int total = 0;
+	float peak = NF_MIN_DB;
+	int b;
+
+	for (b = 0; b < NF_BUCKETS; b++) {
+		counts[b] = __atomic_exchange_n( &nf->recent[b], 0, __ATOMIC_ACQ_REL );
+		if (counts[b]) peak = NF_MIN_DB + (b + 1) * NF_STEP_DB;
+		total += counts[b];
+	}
+
+	// Don't learn what dead air sounds like
+	if (!learn || !total || peak < NF_DEAD_AIR_DB) return;
+
+	nf->total = 0.0f;
+	for (b = 0; b < NF_BUCKETS; b++) {
+		nf->hist[b] = nf->hist[b] * nf->decay + counts[b];
+		nf->total += nf->hist[b];
+	}
+	nf->learnt++;
+
+	nf->floor = noisefloor_quantile( nf, NF_QUANTILE );
+	nf->median = noisefloor_quantile( nf, 0.5f );
+}
+
+
+/* The silence threshold to use, or fallback if not enough has been learnt */
+float noisefloor_threshold( noisefloor_t *nf, float fallback )
+{
+	float threshold;
+
+	if (nf->learnt < NF_LEARN_SECS) return fallback;
+
+	// Keep well clear of the programme itself
+	threshold = nf->floor + nf->offset;
+	if (threshold > nf->median - NF_MARGIN_DB) {
+		threshold = nf->median - NF_MARGIN_DB;
+	}
+
+	return threshold;
+}
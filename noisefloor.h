@@ -0,0 +1,59 @@
+/*
+
+	noisefloor.h
+	Adaptive noise floor tracking for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef NOISEFLOOR_H
+#define NOISEFLOOR_H
+
+
+#define NF_MIN_DB			-90.0f	// Bottom of the histogram
+#define NF_STEP_DB			0.5f	// Width of each histogram bucket
+#define NF_BUCKETS			180		// Covers -90dB to 0dB
+#define NF_QUANTILE			0.1f	// Fraction of blocks considered to be floor
+#define NF_MEMORY_SECS		600		// Time constant of the histogram
+#define NF_LEARN_SECS		60		// Seconds learnt before the floor is used
+#define NF_DEAD_AIR_DB		-85.0f	// Never learn from seconds quieter than this
+#define NF_MARGIN_DB		10.0f	// Threshold stays this far below median level
+
+
+/*
+	The process thread drops the peak of each block into the 'recent'
+	buckets. Once a second the monitor thread either folds those into
+	the long-term histogram, which decays so that it follows changes in
+	the source, or throws them away if that second looked like dead air.
+	Memory use is fixed however long it runs.
+*/
+typedef struct {
+	float offset;						// Threshold is this far above the floor (dB)
+	unsigned int recent[NF_BUCKETS];	// Block peaks since last update
+	float hist[NF_BUCKETS];				// Decaying histogram of block peaks
+	float total;						// Sum of hist
+	float decay;						// Per-second decay of hist
+	unsigned int learnt;				// Seconds folded into hist
+
+	float floor;						// Latest estimate of the noise floor (dB)
+	float median;						// Latest estimate of the median level (dB)
+} noisefloor_t;
+
+
+void noisefloor_init( noisefloor_t *nf );
+void noisefloor_add( noisefloor_t *nf, float peak );
+void noisefloor_update( noisefloor_t *nf, int learn );
+float noisefloor_threshold( noisefloor_t *nf, float fallback );
+
+
+#endif
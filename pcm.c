@@ -0,0 +1,343 @@
+/*
+
+	pcm.c
+	Raw PCM input from a pipe or file, instead of JACK
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "pcm.h"
+
+
+// Scans a block of frames into levels, and floats if asked for
+typedef void (*pcm_scan_t)( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block );
+
+static void scan_s16( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block );
+static void scan_s24( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block );
+static void scan_s32( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block );
+static void scan_f32( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block );
+
+static const struct {
+	const char* name;
+	int format;
+	unsigned int bytes;
+	pcm_scan_t scan;
+} formats[] = {
+	{ "s16", PCM_S16, 2, scan_s16 },
+	{ "s24", PCM_S24, 3, scan_s24 },
+	{ "s32", PCM_S32, 4, scan_s32 },
+	{ "f32", PCM_F32, 4, scan_f32 },
+	{ NULL, 0, 0, NULL }
+};
+
+
+
+/* <path>[,format=s16|s24|s32|f32][,channels=<n>][,rate=<hz>] */
+static
+int parse_spec( pcm_input_t *in, const char* spec )
+{
+	char copy[sizeof(in->path) + 64];
+	char *name, *opt, *save = NULL;
+	int i;
+
+	if (strlen( spec ) >= sizeof(copy)) {
+		fprintf(stderr, "Input spec is too long: %s\n", spec);
+		return -1;
+	}
+	strcpy( copy, spec );
+	if (!(name = strtok_r( copy, ",", &save )) || strlen( name ) >= sizeof(in->path)) {
+		fprintf(stderr, "Input file name is missing or too long.\n");
+		return -1;
+	}
+	strcpy( in->path, name );
+
+	while ((opt = strtok_r( NULL, ",", &save ))) {
+		char *value = strchr( opt, '=' );
+		if (!value) goto error;
+		*value++ = '\0';
+
+		if (strcmp( opt, "format" ) == 0) {
+			for (i = 0; formats[i].name && strcmp( formats[i].name, value ); i++);
+			if (!formats[i].name) goto error;
+			in->format = formats[i].format;
+			in->bytes = formats[i].bytes;
+			in->scan = formats[i].scan;
+		} else if (strcmp( opt, "channels" ) == 0) {
+			in->channels = atoi( value );
+			if (in->channels < 1 || in->channels > PCM_CHANNELS_MAX) goto error;
+		} else if (strcmp( opt, "rate" ) == 0) {
+			in->sample_rate = atoi( value );
+			if (in->sample_rate < 1000) goto error;
+		} else {
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	fprintf(stderr, "Invalid input setting: %s\n", opt);
+	return -1;
+}
+
+
+/* Open a stream and allocate buffers for a second of it. Returns non-zero on failure. */
+int pcm_open( pcm_input_t *in, const char* spec )
+{
+	unsigned int c, blocks;
+
+	memset( in, 0, sizeof(pcm_input_t) );
+	in->fd = -1;
+	in->format = PCM_S16;
+	in->bytes = 2;
+	in->scan = scan_s16;
+	in->convert = 1;
+	in->channels = PCM_DEFAULT_CHANNELS;
+	in->sample_rate = PCM_DEFAULT_RATE;
+	if (parse_spec( in, spec )) return -1;
+
+	if (strcmp( in->path, "-" ) == 0) {
+		in->fd = STDIN_FILENO;
+	} else if ((in->fd = open( in->path, O_RDONLY )) < 0) {
+		perror( in->path );
+		return -1;
+	}
+
+	in->capacity = in->sample_rate;
+	in->raw = malloc( (size_t)in->capacity * in->channels * in->bytes );
+	in->mix = calloc( in->capacity, sizeof(float) );
+	blocks = (in->capacity + PCM_BLOCK_SIZE - 1) / PCM_BLOCK_SIZE;
+	for (c = 0; c < in->channels; c++) {
+		in->audio[c] = calloc( in->capacity, sizeof(float) );
+		in->peak[c] = calloc( blocks, sizeof(float) );
+		in->squares[c] = calloc( blocks, sizeof(float) );
+		if (!in->audio[c] || !in->peak[c] || !in->squares[c]) break;
+	}
+	if (!in->raw || !in->mix || c < in->channels) {
+		perror("pcm_open(): malloc failed");
+		pcm_close( in );
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* An integer sample, as a signed 32-bit value */
+static inline __attribute__((always_inline))
+int32_t load_sample( const unsigned char *p, const int format )
+{
+	int16_t s16;
+	int32_t s32;
+
+	switch (format) {
+		case PCM_S16: memcpy( &s16, p, 2 ); return s16;
+		case PCM_S24: return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+		default: memcpy( &s32, p, 4 ); return s32;
+	}
+}
+
+
+/*
+	One pass over a block of interleaved integer frames. The peak and
+	sum of squares of every channel are worked out on the integers,
+	and the samples are written out as floats only if convert is set.
+	32-bit samples lose their low 8 bits before squaring, so that the
+	sums can't overflow. Every argument after 'block' is a constant in
+	the variants below, so the loop has no tests left in it. Built with
+	-ftree-vectorize (see Makefile.am), GCC vectorises the loop over
+	the channels in the general variant; the mono and stereo loops,
+	with their packed loads and 64-bit sums, stay scalar.
+*/
+static inline __attribute__((always_inline))
+void scan_int( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block,
+               const unsigned int channels, const int format, const int convert )
+{
+	const unsigned int bytes = format == PCM_S16 ? 2 : format == PCM_S24 ? 3 : 4;
+	const int shift = format == PCM_S32 ? 8 : 0;
+	const float scale = format == PCM_S16 ? 1.0f / 32768.0f : format == PCM_S24 ? 1.0f / 8388608.0f : 1.0f / 2147483648.0f;
+	const float square_scale = (scale * (1 << shift)) * (scale * (1 << shift));
+	const unsigned char *p = in->raw + (size_t)first * channels * bytes;
+	uint32_t peak[PCM_CHANNELS_MAX];
+	int64_t squares[PCM_CHANNELS_MAX];
+	unsigned int c, i;
+
+	for (c = 0; c < channels; c++) {
+		peak[c] = 0;
+		squares[c] = 0;
+	}
+
+	for (i = 0; i < nframes; i++) {
+		for (c = 0; c < channels; c++, p += bytes) {
+			const int32_t v = load_sample( p, format );
+			const uint32_t mag = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+			const int64_t q = v >> shift;
+
+			if (mag > peak[c]) peak[c] = mag;
+			squares[c] += q * q;
+			if (convert) in->audio[c][first + i] = v * scale;
+		}
+	}
+
+	for (c = 0; c < channels; c++) {
+		in->peak[c][block] = peak[c] * scale;
+		in->squares[c][block] = squares[c] * square_scale;
+	}
+}
+
+
+/* The same for float samples, which need no converting */
+static inline __attribute__((always_inline))
+void scan_float( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block,
+                 const unsigned int channels, const int convert )
+{
+	const float *p = (const float*)in->raw + (size_t)first * channels;
+	float peak[PCM_CHANNELS_MAX];
+	float squares[PCM_CHANNELS_MAX];
+	unsigned int c, i;
+
+	for (c = 0; c < channels; c++) {
+		peak[c] = 0.0f;
+		squares[c] = 0.0f;
+	}
+
+	for (i = 0; i < nframes; i++) {
+		for (c = 0; c < channels; c++, p++) {
+			const float mag = fabsf( *p );
+
+			if (mag > peak[c]) peak[c] = mag;
+			squares[c] += *p * *p;
+			if (convert) in->audio[c][first + i] = *p;
+		}
+	}
+
+	for (c = 0; c < channels; c++) {
+		in->peak[c][block] = peak[c];
+		in->squares[c][block] = squares[c];
+	}
+}
+
+
+/* Mono and stereo get loops of their own, anything else the general one */
+#define SCAN_VARIANT(name, call) \
+	static void name( pcm_input_t *in, unsigned int first, unsigned int nframes, unsigned int block ) \
+	{ \
+		switch ((in->channels > 2 ? 0 : in->channels) + 3 * (in->convert != 0)) { \
+			case 0: call( 0, in->channels ); break; \
+			case 1: call( 0, 1 ); break; \
+			case 2: call( 0, 2 ); break; \
+			case 3: call( 1, in->channels ); break; \
+			case 4: call( 1, 1 ); break; \
+			case 5: call( 1, 2 ); break; \
+		} \
+	}
+
+#define SCAN_S16(convert, channels) scan_int( in, first, nframes, block, channels, PCM_S16, convert )
+#define SCAN_S24(convert, channels) scan_int( in, first, nframes, block, channels, PCM_S24, convert )
+#define SCAN_S32(convert, channels) scan_int( in, first, nframes, block, channels, PCM_S32, convert )
+#define SCAN_F32(convert, channels) scan_float( in, first, nframes, block, channels, convert )
+
+SCAN_VARIANT(scan_s16, SCAN_S16)
+SCAN_VARIANT(scan_s24, SCAN_S24)
+SCAN_VARIANT(scan_s32, SCAN_S32)
+SCAN_VARIANT(scan_f32, SCAN_F32)
+
+
+/*
+	Read the next second of the stream, blocking until it has all
+	arrived. Returns the number of frames read, which is only less
+	than a second at the end of the stream (0 once it has ended).
+*/
+unsigned int pcm_read( pcm_input_t *in )
+{
+	const size_t frame_bytes = (size_t)in->channels * in->bytes;
+	const size_t want = frame_bytes * in->capacity;
+	size_t got = 0;
+	unsigned int nframes, i, block;
+
+	while (got < want) {
+		ssize_t n = read( in->fd, in->raw + got, want - got );
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) perror("pcm_read(): read failed");
+		if (n <= 0) break;
+		got += n;
+	}
+
+	// A frame cut short at the end of the stream is dropped
+	nframes = got / frame_bytes;
+	for (i = 0, block = 0; i < nframes; i += PCM_BLOCK_SIZE, block++) {
+		in->scan( in, i, nframes - i < PCM_BLOCK_SIZE ? nframes - i : PCM_BLOCK_SIZE, block );
+	}
+	in->frames += nframes;
+
+	return nframes;
+}
+
+
+/* Levels of a block of all the channels together: the loudest peak
+   and the total power, so a single live channel is heard in full */
+void pcm_levels( const pcm_input_t *in, unsigned int block, float *peak, float *squares )
+{
+	unsigned int c;
+
+	*peak = 0.0f;
+	*squares = 0.0f;
+	for (c = 0; c < in->channels; c++) {
+		if (in->peak[c][block] > *peak) *peak = in->peak[c][block];
+		*squares += in->squares[c][block];
+	}
+}
+
+
+/* Average the channels of the last read into in->mix, for analysers
+   that need samples. Not for metering: opposite phases cancel out. */
+void pcm_mix( pcm_input_t *in, unsigned int nframes )
+{
+	const float scale = 1.0f / in->channels;
+	unsigned int c, i;
+
+	memcpy( in->mix, in->audio[0], sizeof(float) * nframes );
+	for (c = 1; c < in->channels; c++) {
+		for (i = 0; i < nframes; i++) in->mix[i] += in->audio[c][i];
+	}
+	for (i = 0; i < nframes; i++) in->mix[i] *= scale;
+}
+
+
+void pcm_close( pcm_input_t *in )
+{
+	unsigned int c;
+
+	if (in->fd > STDIN_FILENO) close( in->fd );
+	in->fd = -1;
+	free( in->raw );
+	free( in->mix );
+	for (c = 0; c < PCM_CHANNELS_MAX; c++) {
+		free( in->audio[c] );
+		free( in->peak[c] );
+		free( in->squares[c] );
+		in->audio[c] = NULL;
+		in->peak[c] = NULL;
+		in->squares[c] = NULL;
+	}
+	in->raw = NULL;
+	in->mix = NULL;
+}
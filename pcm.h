@@ -0,0 +1,75 @@
+/*
+
+	pcm.h
+	Raw PCM input from a pipe or file, instead of JACK
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef PCM_H
+#define PCM_H
+
+#include <stdint.h>
+
+
+#define PCM_CHANNELS_MAX	32			// Most channels in a stream
+#define PCM_BLOCK_SIZE		1024		// Frames given to the detectors at a time
+#define PCM_DEFAULT_RATE	48000
+#define PCM_DEFAULT_CHANNELS	2
+
+
+// Sample formats, all little-endian and interleaved
+enum {
+	PCM_S16,					// 16-bit signed
+	PCM_S24,					// 24-bit signed, packed in 3 bytes
+	PCM_S32,					// 32-bit signed
+	PCM_F32						// 32-bit float
+};
+
+
+/*
+	The stream has no clock but its own: time is the number of frames
+	read divided by the sample rate, however fast they arrive. Frames
+	are read a second at a time with as few read() calls as the pipe
+	allows, then gone over once, block by block, for the peak and sum
+	of squares of each channel (on the integers, for integer formats)
+	and, if convert is set, split into a float buffer per channel.
+*/
+typedef struct pcm_input {
+	int fd;
+	int format;
+	unsigned int bytes;				// Bytes per sample
+	unsigned int channels;
+	unsigned int sample_rate;
+	char path[256];					// "-" for stdin
+
+	unsigned char *raw;				// Interleaved frames, as read
+	unsigned int capacity;			// Frames the buffers hold
+	float *audio[PCM_CHANNELS_MAX];	// Each channel of the last read
+	float *mix;						// Average of the channels of the last read
+	float *peak[PCM_CHANNELS_MAX];		// Peak of each block of each channel
+	float *squares[PCM_CHANNELS_MAX];	// Sum of squares of each block of each channel
+	int convert;					// Fill in audio, not just the levels
+	void (*scan)( struct pcm_input *in, unsigned int first, unsigned int nframes, unsigned int block );
+	uint64_t frames;				// Frames read since the start
+} pcm_input_t;
+
+
+int pcm_open( pcm_input_t *in, const char* spec );
+unsigned int pcm_read( pcm_input_t *in );
+void pcm_levels( const pcm_input_t *in, unsigned int block, float *peak, float *squares );
+void pcm_mix( pcm_input_t *in, unsigned int nframes );
+void pcm_close( pcm_input_t *in );
+
+
+#endif
@@ -0,0 +1,266 @@
+/*
+
+	portindex.c
+	Index of JACK output ports, kept up to date from graph callbacks
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <jack/jack.h>
+#include <jack/ringbuffer.h>
+
+#include "portindex.h"
+
+
+// A change to the graph, as seen by the JACK notification thread
+typedef struct {
+	int connect;				// Non-zero for a connection, zero for a registration
+	jack_port_id_t a;			// Port (un)registered, or source of the connection
+	jack_port_id_t b;			// Destination of the connection
+	int on;						// Registered or connected, rather than the reverse
+} graph_change_t;
+
+// An output port we know about
+typedef struct {
+	jack_port_t *port;
+	char name[PORTINDEX_NAME_MAX];
+} port_entry_t;
+
+
+static jack_ringbuffer_t *queue = NULL;	// Changes waiting for portindex_update()
+static int overflowed = 0;				// Changes were lost, so load everything again
+static port_entry_t *ports = NULL;		// Known audio output ports
+static int port_count = 0;
+static int port_space = 0;
+
+
+
+/* Work out how to match a pattern. Returns non-zero if a regex is invalid. */
+int portmatch_compile( portmatch_t *pm, const char* pattern )
+{
+	size_t len = strlen( pattern );
+	int err;
+
+	memset( pm, 0, sizeof(portmatch_t) );
+	snprintf( pm->pattern, sizeof(pm->pattern), "%s", pattern );
+
+	if (len == 0) {
+		pm->kind = PORTMATCH_NONE;
+	} else if (len > 2 && pattern[0] == '/' && pattern[len-1] == '/') {
+		char expr[RULE_PATTERN_MAX];
+
+		snprintf( expr, sizeof(expr), "%.*s", (int)len - 2, pattern + 1 );
+		if ((err = regcomp( &pm->regex, expr, REG_EXTENDED | REG_NOSUB ))) {
+			char msg[128];
+			regerror( err, &pm->regex, msg, sizeof(msg) );
+			fprintf(stderr, "portmatch_compile(): invalid port pattern '%s': %s\n", pattern, msg);
+			pm->kind = PORTMATCH_NONE;
+			return -1;
+		}
+		pm->kind = PORTMATCH_REGEX;
+	} else if (strpbrk( pattern, "*?[" )) {
+		pm->kind = PORTMATCH_GLOB;
+	} else {
+		pm->kind = PORTMATCH_EXACT;
+	}
+
+	return 0;
+}
+
+
+/* Does a full port name match the pattern? */
+int portmatch_test( const portmatch_t *pm, const char* name )
+{
+	switch (pm->kind) {
+		case PORTMATCH_EXACT: return strcmp( pm->pattern, name ) == 0;
+		case PORTMATCH_GLOB: return fnmatch( pm->pattern, name, 0 ) == 0;
+		case PORTMATCH_REGEX: return regexec( &pm->regex, name, 0, NULL, 0 ) == 0;
+	}
+	return 0;
+}
+
+
+void portmatch_free( portmatch_t *pm )
+{
+	if (pm->kind == PORTMATCH_REGEX) regfree( &pm->regex );
+	pm->kind = PORTMATCH_NONE;
+}
+
+
+/* Queue a change for the monitor thread (called from JACK's notification thread) */
+static
+void push_change( int connect, jack_port_id_t a, jack_port_id_t b, int on )
+{
+	graph_change_t change = { connect, a, b, on };
+
+	if (jack_ringbuffer_write_space( queue ) < sizeof(change)) {
+		__atomic_store_n( &overflowed, 1, __ATOMIC_RELEASE );
+		return;
+	}
+	jack_ringbuffer_write( queue, (const char*)&change, sizeof(change) );
+}
+
+
+static
+void registration_callback_jack( jack_port_id_t id, int registered, void *arg )
+{
+	push_change( 0, id, 0, registered );
+}
+
+
+static
+void connect_callback_jack( jack_port_id_t a, jack_port_id_t b, int connected, void *arg )
+{
+	push_change( 1, a, b, connected );
+}
+
+
+/* Ask JACK to tell us about graph changes. Must be called before jack_activate(). */
+void portindex_init( jack_client_t *client )
+{
+	if (!queue && !(queue = jack_ringbuffer_create( sizeof(graph_change_t) * PORTINDEX_QUEUE ))) {
+		fprintf(stderr, "portindex_init(): failed to create queue\n");
+		exit(1);
+	}
+
+	jack_set_port_registration_callback( client, registration_callback_jack, NULL );
+	jack_set_port_connect_callback( client, connect_callback_jack, NULL );
+}
+
+
+static
+int find_port( const jack_port_t *port )
+{
+	int i;
+
+	for (i = 0; port && i < port_count; i++) {
+		if (ports[i].port == port) return i;
+	}
+	return -1;
+}
+
+
+/* Add a port to the index, returns its name if it is a new audio output */
+static
+const char* add_port( jack_client_t *client, jack_port_t *port )
+{
+	port_entry_t *entry;
+
+	if (!port || !(jack_port_flags( port ) & JackPortIsOutput)) return NULL;
+	if (strcmp( jack_port_type( port ), JACK_DEFAULT_AUDIO_TYPE )) return NULL;
+	if (find_port( port ) >= 0) return NULL;
+
+	if (port_count == port_space) {
+		int space = port_space ? port_space * 2 : 64;
+		port_entry_t *grown = realloc( ports, sizeof(port_entry_t) * space );
+		if (!grown) {
+			perror("add_port(): realloc failed");
+			return NULL;
+		}
+		ports = grown;
+		port_space = space;
+	}
+
+	entry = &ports[port_count++];
+	entry->port = port;
+	snprintf( entry->name, sizeof(entry->name), "%s", jack_port_name( port ) );
+	return entry->name;
+}
+
+
+/* Fill the index from scratch. Called once the client is active. */
+void portindex_load( jack_client_t *client )
+{
+	graph_change_t change;
+	const char** names;
+	int i;
+
+	// Anything queued before now is covered by the scan
+	while (jack_ringbuffer_read( queue, (char*)&change, sizeof(change) ) == sizeof(change));
+	__atomic_store_n( &overflowed, 0, __ATOMIC_RELEASE );
+
+	port_count = 0;
+	names = jack_get_ports( client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput );
+	for (i = 0; names && names[i]; i++) {
+		add_port( client, jack_port_by_name( client, names[i] ) );
+	}
+	if (names) jack_free( names );
+}
+
+
+/*
+	Apply the graph changes since the last call, calling the handler with
+	each output port that has appeared, and each one that has been
+	disconnected from one of our ports.
+*/
+void portindex_update( jack_client_t *client, portindex_handler_t handler, void *arg )
+{
+	graph_change_t change;
+	const char* name;
+	int i;
+
+	if (__atomic_load_n( &overflowed, __ATOMIC_ACQUIRE )) {
+		portindex_load( client );
+		portindex_each( handler, arg );
+		return;
+	}
+
+	while (jack_ringbuffer_read( queue, (char*)&change, sizeof(change) ) == sizeof(change)) {
+		if (!change.connect && change.on) {
+			if ((name = add_port( client, jack_port_by_id( client, change.a ) ))) {
+				handler( name, arg );
+			}
+		} else if (!change.connect) {
+			if ((i = find_port( jack_port_by_id( client, change.a ) )) >= 0) {
+				ports[i] = ports[--port_count];
+			}
+		} else if (!change.on) {
+			jack_port_t *ours = jack_port_by_id( client, change.b );
+			if (ours && jack_port_is_mine( client, ours ) &&
+			    (i = find_port( jack_port_by_id( client, change.a ) )) >= 0) {
+				handler( ports[i].name, arg );
+			}
+		}
+	}
+}
+
+
+/* Call the handler with every output port in the index */
+void portindex_each( portindex_handler_t handler, void *arg )
+{
+	int i;
+
+	for (i = 0; i < port_count; i++) {
+		handler( ports[i].name, arg );
+	}
+}
+
+
+int portindex_count()
+{
+	return port_count;
+}
+
+
+void portindex_finish()
+{
+	if (queue) jack_ringbuffer_free( queue );
+	queue = NULL;
+	free( ports );
+	ports = NULL;
+	port_count = port_space = 0;
+}
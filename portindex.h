@@ -0,0 +1,62 @@
+/*
+
+	portindex.h
+	Index of JACK output ports, kept up to date from graph callbacks
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef PORTINDEX_H
+#define PORTINDEX_H
+
+#include <regex.h>
+#include <jack/jack.h>
+
+#include "rules.h"
+
+
+#define PORTINDEX_NAME_MAX		320		// Longest full port name (client:port)
+#define PORTINDEX_QUEUE			1024	// Graph changes held between updates
+
+
+// How a pattern is matched against port names
+enum {
+	PORTMATCH_NONE,				// Empty pattern, matches nothing
+	PORTMATCH_EXACT,			// A plain port name
+	PORTMATCH_GLOB,				// Contains any of * ? [
+	PORTMATCH_REGEX				// Written as /regex/
+};
+
+typedef struct {
+	int kind;
+	char pattern[RULE_PATTERN_MAX];
+	regex_t regex;
+} portmatch_t;
+
+
+/* Called for each output port that may need connecting */
+typedef void (*portindex_handler_t)( const char* name, void *arg );
+
+
+int portmatch_compile( portmatch_t *pm, const char* pattern );
+int portmatch_test( const portmatch_t *pm, const char* name );
+void portmatch_free( portmatch_t *pm );
+
+void portindex_init( jack_client_t *client );
+void portindex_load( jack_client_t *client );
+void portindex_update( jack_client_t *client, portindex_handler_t handler, void *arg );
+void portindex_each( portindex_handler_t handler, void *arg );
+int portindex_count();
+void portindex_finish();
+
+#endif
@@ -0,0 +1,211 @@
+/*
+
+	rtsafe.c
+	Real-time safe memory and thread setup for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "config.h"
+#include "rtsafe.h"
+
+
+static char *arena = NULL;			// Start of the arena
+static size_t arena_size = 0;		// Bytes mapped
+static size_t slot_size = 0;		// Bytes per slot, a whole number of cache lines
+static int slot_count = 0;
+static unsigned char *in_use = NULL;	// Which slots have been handed out (monitor thread only)
+
+
+
+/* Map, lock and prefault the arena. Returns non-zero on failure. */
+int rt_arena_init( size_t size, int slots )
+{
+	slot_size = (size + 63) & ~(size_t)63;
+	slot_count = slots;
+	arena_size = slot_size * slots;
+
+	arena = mmap( NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if (arena == MAP_FAILED) {
+		perror("rt_arena_init(): mmap failed");
+		arena = NULL;
+		return -1;
+	}
+	if (!(in_use = calloc( slots, 1 ))) {
+		perror("rt_arena_init(): calloc failed");
+		return -1;
+	}
+
+	// Without the lock the kernel may page it out again, which is worth a warning
+	if (mlock( arena, arena_size )) {
+		perror("rt_arena_init(): mlock failed (check RLIMIT_MEMLOCK)");
+	}
+	memset( arena, 0, arena_size );
+
+	return 0;
+}
+
+
+/* Claim a zeroed block (monitor thread only) */
+void* rt_alloc( size_t size )
+{
+	void *ptr;
+	int i;
+
+	if (size <= slot_size) {
+		for (i = 0; i < slot_count; i++) {
+			if (in_use[i]) continue;
+			in_use[i] = 1;
+			ptr = arena + i * slot_size;
+			memset( ptr, 0, slot_size );
+			return ptr;
+		}
+	}
+
+	// Out of slots: the heap will do, locked at least
+	if ((ptr = calloc( 1, size ))) {
+		mlock( ptr, size );
+	}
+	return ptr;
+}
+
+
+/* Give back a block from rt_alloc() (monitor thread only) */
+void rt_free( void *ptr )
+{
+	char *p = ptr;
+
+	if (!p) return;
+	if (arena && p >= arena && p < arena + arena_size) {
+		in_use[ (p - arena) / slot_size ] = 0;
+	} else {
+		free( ptr );
+	}
+}
+
+
+void rt_arena_finish()
+{
+	if (arena) munmap( arena, arena_size );
+	arena = NULL;
+	free( in_use );
+	in_use = NULL;
+}
+
+
+/* Flush denormals to zero, so decaying signals don't slow down the maths */
+static
+void denormals_zero()
+{
+#if defined(__SSE__)
+	_mm_setcsr( _mm_getcsr() | 0x8040 );	// FTZ and DAZ
+#elif defined(__aarch64__)
+	uint64_t fpcr;
+	__asm__ volatile ("mrs %0, fpcr" : "=r" (fpcr));
+	__asm__ volatile ("msr fpcr, %0" : : "r" (fpcr | (1 << 24)));	// FZ
+#endif
+}
+
+
+/* Called by JACK in the process thread before it starts (see jack_set_thread_init_callback) */
+void rt_thread_init( void *arg )
+{
+	char stack[RT_STACK_PREFAULT];
+	volatile char *page = stack;
+	size_t i;
+
+	denormals_zero();
+
+	// Touch the stack now, rather than fault it in during a callback.
+	// Every store is through a volatile pointer, so none can be left out.
+	for (i = 0; i < sizeof(stack); i += 4096) page[i] = 0;
+	page[sizeof(stack) - 1] = 0;
+}
+
+
+#ifdef RT_DEBUG
+
+extern void *__libc_malloc( size_t size );
+extern void *__libc_calloc( size_t count, size_t size );
+extern void *__libc_realloc( void *ptr, size_t size );
+extern void __libc_free( void *ptr );
+
+static __thread int in_rt = 0;		// Inside the process callback on this thread
+
+
+void rt_enter()
+{
+	in_rt = 1;
+}
+
+
+void rt_leave()
+{
+	in_rt = 0;
+}
+
+
+static
+void trap( const char* func )
+{
+	static const char msg[] = "rtsafe: memory allocator called from the process thread: ";
+	ssize_t ignored;
+
+	// About to abort, so there is nothing to do if these fail
+	in_rt = 0;
+	ignored = write( 2, msg, sizeof(msg) - 1 );
+	ignored = write( 2, func, strlen( func ) );
+	ignored = write( 2, "\n", 1 );
+	(void)ignored;
+	abort();
+}
+
+
+void *malloc( size_t size )
+{
+	if (in_rt) trap( "malloc" );
+	return __libc_malloc( size );
+}
+
+
+void *calloc( size_t count, size_t size )
+{
+	if (in_rt) trap( "calloc" );
+	return __libc_calloc( count, size );
+}
+
+
+void *realloc( void *ptr, size_t size )
+{
+	if (in_rt) trap( "realloc" );
+	return __libc_realloc( ptr, size );
+}
+
+
+void free( void *ptr )
+{
+	if (in_rt && ptr) trap( "free" );
+	__libc_free( ptr );
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+
+	rtsafe.h
+	Real-time safe memory and thread setup for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef RTSAFE_H
+#define RTSAFE_H
+
+#include <stddef.h>
+
+
+#define RT_STACK_PREFAULT	(64 * 1024)	// Stack touched when the process thread starts
+
+
+/*
+	Everything the process thread reads or writes is allocated up front
+	in one arena of equal sized slots, which is locked into memory and
+	written to so that no page faults are left for the process thread
+	to take. If the arena runs out, slots come from the heap instead
+	(locked, but not prefaulted as a whole).
+*/
+int rt_arena_init( size_t slot_size, int slots );
+void* rt_alloc( size_t size );
+void rt_free( void *ptr );
+void rt_arena_finish();
+
+void rt_thread_init( void *arg );
+
+
+/*
+	In debug builds (configure --enable-rt-debug) any call to malloc,
+	calloc, realloc or free between rt_enter() and rt_leave() on the
+	same thread prints a message and aborts, leaving a core dump that
+	shows where it came from.
+*/
+#ifdef RT_DEBUG
+void rt_enter();
+void rt_leave();
+#else
+#define rt_enter()
+#define rt_leave()
+#endif
+
+#endif
@@ -0,0 +1,426 @@
+/*
+
+	rules.c
+	Per-port detection rules for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+
+#include "rules.h"
+#include "portindex.h"
+
+
+static ruleset_t *current = NULL;		// Rules in use by the monitor thread
+static unsigned long epoch = 0;			// Bumped every time the monitor is quiescent
+static unsigned long generation = 0;	// Generation of last published rules
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char watch_path[1024];			// Rules file being watched
+static const char* watch_file = NULL;	// File name part of watch_path
+static rules_check_t watch_check = NULL;	// Extra checks on reloaded rules, or NULL
+static int watch_fd = -1;				// inotify descriptor
+static pthread_t watch_thread;
+static int watching = 0;
+static volatile sig_atomic_t hangup = 0;	// Set by SIGHUP
+
+
+void rule_defaults( rule_t *rule, const char* name )
+{
+	memset( rule, 0, sizeof(rule_t) );
+	snprintf( rule->name, sizeof(rule->name), "%s", name );
+	snprintf( rule->ref_name, sizeof(rule->ref_name), "%s_ref", name );
+	settings_defaults( &rule->settings );
+}
+
+
+/* True if both rules need the same set of detectors and ports, so a
+   channel can switch from one to the other without being rebuilt */
+int rule_same_detectors( const rule_t *a, const rule_t *b )
+{
+	return strcmp( a->name, b->name ) == 0 &&
+	       strcmp( a->ref_name, b->ref_name ) == 0 &&
+	       a->adaptive == b->adaptive &&
+	       a->tone_count == b->tone_count &&
+	       memcmp( a->tones, b->tones, sizeof(float) * a->tone_count ) == 0 &&
+	       (a->flatness > 0.0f) == (b->flatness > 0.0f) &&
+	       (a->settings.loop_period > 0) == (b->settings.loop_period > 0) &&
+	       (a->similarity > 0.0f) == (b->similarity > 0.0f);
+}
+
+
+/* The stage to run once an alarm has lasted elapsed seconds */
+const stage_t* rule_stage( const rule_t *rule, int elapsed )
+{
+	const stage_t *stage = NULL;
+	int i;
+
+	for (i = 0; i < rule->stage_count; i++) {
+		if (rule->stages[i].after <= elapsed) stage = &rule->stages[i];
+	}
+
+	return stage;
+}
+
+
+static
+char* trim( char *s )
+{
+	char *end;
+
+	while (isspace( (unsigned char)*s )) s++;
+	end = s + strlen( s );
+	while (end > s && isspace( (unsigned char)end[-1] )) *--end = '\0';
+
+	return s;
+}
+
+
+static
+int parse_bool( const char* value )
+{
+	return strcmp( value, "yes" ) == 0 || strcmp( value, "true" ) == 0 ||
+	       strcmp( value, "on" ) == 0 || strcmp( value, "1" ) == 0;
+}
+
+
+static
+int add_stage( rule_t *rule, int after, const char* command )
+{
+	int i;
+
+	if (rule->stage_count >= RULE_MAX_STAGES) return -1;
+
+	// Keep the stages sorted by when they start
+	for (i = rule->stage_count; i > 0 && rule->stages[i-1].after > after; i--) {
+		rule->stages[i] = rule->stages[i-1];
+	}
+	rule->stages[i].after = after;
+	snprintf( rule->stages[i].command, RULE_COMMAND_MAX, "%s", command );
+	rule->stage_count++;
+
+	return 0;
+}
+
+
+/* Check a port name or pattern can be used for connecting */
+static
+int valid_pattern( const char* value )
+{
+	portmatch_t pm;
+
+	if (portmatch_compile( &pm, value )) return 0;
+	portmatch_free( &pm );
+	return 1;
+}
+
+
+/* Apply one 'key = value' setting to a rule. Returns non-zero if it is invalid. */
+int rule_set( rule_t *rule, const char* key, const char* value )
+{
+	if (strcmp( key, "connect" ) == 0) {
+		if (!valid_pattern( value )) return -1;
+		snprintf( rule->connect, sizeof(rule->connect), "%s", value );
+	} else if (strcmp( key, "reference" ) == 0) {
+		if (!valid_pattern( value )) return -1;
+		snprintf( rule->reference, sizeof(rule->reference), "%s", value );
+	} else if (strcmp( key, "reverse" ) == 0) {
+		rule->reverse = parse_bool( value );
+	} else if (strcmp( key, "adaptive" ) == 0) {
+		rule->adaptive = 1;
+		rule->adaptive_offset = atof( value );
+	} else if (strcmp( key, "tone" ) == 0) {
+		if (rule->tone_count >= TONE_MAX_FREQS || atof( value ) <= 0.0f) return -1;
+		rule->tones[ rule->tone_count++ ] = atof( value );
+	} else if (strcmp( key, "flatness" ) == 0) {
+		rule->flatness = atof( value );
+	} else if (strcmp( key, "similarity" ) == 0) {
+		rule->similarity = atof( value );
+	} else if (strcmp( key, "command" ) == 0) {
+		return add_stage( rule, 0, value );
+	} else if (strcmp( key, "escalate" ) == 0) {
+		// escalate = <seconds> <command>
+		const char* command = value + strcspn( value, " \t" );
+		if (!*command) return -1;
+		while (isspace( (unsigned char)*command )) command++;
+		return add_stage( rule, atoi( value ), command );
+	} else {
+		return settings_set( &rule->settings, key, value );
+	}
+
+	return 0;
+}
+
+
+/*
+	Read a rules file. Each [section] describes one port to monitor,
+	named after the section, followed by 'key = value' lines. Lines
+	starting with '#' or ';' are comments. Returns non-zero on error,
+	in which case rs should not be used.
+*/
+int rules_load( ruleset_t *rs, const char* path )
+{
+	FILE *file = fopen( path, "r" );
+	rule_t *rule = NULL;
+	char line[1024];
+	int lineno = 0;
+
+	if (!file) {
+		perror( path );
+		return -1;
+	}
+
+	memset( rs, 0, sizeof(ruleset_t) );
+	rs->from_file = 1;
+
+	while (fgets( line, sizeof(line), file )) {
+		char *s = trim( line ), *value, *name;
+		lineno++;
+
+		if (*s == '\0' || *s == '#' || *s == ';') continue;
+
+		if (*s == '[') {
+			char *end = strchr( s, ']' );
+			if (!end) goto error;
+			*end = '\0';
+			name = trim( s + 1 );
+			if (*name == '\0' || rs->count >= RULES_MAX || rules_find( rs, name ) >= 0) goto error;
+			rule = &rs->rule[ rs->count++ ];
+			rule_defaults( rule, name );
+			continue;
+		}
+
+		if (!rule || !(value = strchr( s, '=' ))) goto error;
+		*value++ = '\0';
+		if (rule_set( rule, trim( s ), trim( value ) )) goto error;
+	}
+
+	fclose( file );
+	return 0;
+
+error:
+	fprintf(stderr, "%s:%d: invalid rule: %s\n", path, lineno, line);
+	fclose( file );
+	return -1;
+}
+
+
+/* Index of the rule for the named port, or -1 */
+int rules_find( const ruleset_t *rs, const char* name )
+{
+	int i;
+
+	for (i = 0; i < rs->count; i++) {
+		if (strcmp( rs->rule[i].name, name ) == 0) return i;
+	}
+
+	return -1;
+}
+
+
+/* Swap in new rules (which must have come from malloc) and free the
+   old ones when safe. Call with the lock held. */
+void rules_publish( ruleset_t *rs )
+{
+	ruleset_t *old = NULL;
+	unsigned long seen;
+	int tries = 500;
+
+	rs->generation = ++generation;
+	old = __atomic_exchange_n( &current, rs, __ATOMIC_ACQ_REL );
+	seen = __atomic_load_n( &epoch, __ATOMIC_ACQUIRE );
+
+	// Wait for the monitor thread to let go of the old rules.
+	// If it has stopped (shutting down), leaking them is the safe choice.
+	if (old) {
+		while (__atomic_load_n( &epoch, __ATOMIC_ACQUIRE ) == seen && --tries) {
+			usleep( 10000 );
+		}
+		if (tries) free( old );
+	}
+}
+
+
+/* Serialises changes to the rules: hold while copying, changing and publishing */
+void rules_lock( void )
+{
+	pthread_mutex_lock( &publish_lock );
+}
+
+void rules_unlock( void )
+{
+	pthread_mutex_unlock( &publish_lock );
+}
+
+
+/* A private copy of the current rules, to change and then publish */
+ruleset_t* rules_copy( void )
+{
+	ruleset_t *rs = malloc( sizeof(ruleset_t) );
+
+	if (!rs) {
+		perror("rules_copy(): malloc failed");
+		return NULL;
+	}
+	memcpy( rs, current, sizeof(ruleset_t) );
+
+	return rs;
+}
+
+
+/* Rules for the monitor thread, valid until it next calls rules_quiescent() */
+const ruleset_t* rules_get( void )
+{
+	return __atomic_load_n( &current, __ATOMIC_ACQUIRE );
+}
+
+
+/* Called by the monitor thread when it holds no references to the rules */
+void rules_quiescent( void )
+{
+	__atomic_add_fetch( &epoch, 1, __ATOMIC_RELEASE );
+}
+
+
+/* Load the rules file again, keeping the old rules if it is broken */
+static
+void rules_reload( void )
+{
+	ruleset_t *rs = malloc( sizeof(ruleset_t) );
+
+	if (!rs) {
+		perror("rules_reload(): malloc failed");
+		return;
+	}
+	if (rules_load( rs, watch_path ) || (watch_check && watch_check( rs ))) {
+		fprintf(stderr, "Keeping previous rules.\n");
+		free( rs );
+		return;
+	}
+
+	rules_lock();
+	rules_publish( rs );
+	rules_unlock();
+}
+
+
+static
+void hangup_handler( int sig )
+{
+	hangup = 1;
+}
+
+
+static
+void* rules_watch_thread( void *arg )
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+
+	while (watching) {
+		int changed = 0;
+
+		// Wake up regularly to check for SIGHUP and if we should still be running
+		pfd.fd = watch_fd;
+		pfd.events = POLLIN;
+		if (poll( &pfd, 1, 250 ) > 0) {
+			ssize_t len = read( watch_fd, buf, sizeof(buf) );
+			char *p = buf;
+
+			while (len > 0 && p < buf + len) {
+				const struct inotify_event *ev = (const struct inotify_event *)p;
+				if (ev->len && strcmp( ev->name, watch_file ) == 0) changed = 1;
+				p += sizeof(struct inotify_event) + ev->len;
+			}
+
+			// Let an editor finish writing before reading the file
+			if (changed) usleep( 100000 );
+		}
+
+		if (hangup) {
+			hangup = 0;
+			changed = 1;
+		}
+
+		if (changed) rules_reload();
+	}
+
+	return NULL;
+}
+
+
+/*
+	Reload the rules file whenever it changes or we get SIGHUP.
+	The directory is watched rather than the file, so that editors
+	which replace the file with a new one are noticed too. New rules
+	that check (if not NULL) rejects are ignored, like broken ones.
+*/
+int rules_watch_start( const char* path, rules_check_t check )
+{
+	char dir[sizeof(watch_path)];
+	char *slash;
+
+	if (strlen( path ) >= sizeof(watch_path)) {
+		fprintf(stderr, "Rules file path is too long: %s\n", path);
+		return -1;
+	}
+	strcpy( watch_path, path );
+	watch_check = check;
+	strcpy( dir, path );
+	if ((slash = strrchr( dir, '/' ))) {
+		slash[1] = '\0';
+		watch_file = watch_path + (slash + 1 - dir);
+	} else {
+		strcpy( dir, "." );
+		watch_file = watch_path;
+	}
+
+	// Carry on without inotify if it isn't available: SIGHUP still works
+	if ((watch_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC )) < 0 ||
+	    inotify_add_watch( watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE ) < 0) {
+		perror("rules_watch_start(): failed to watch rules file");
+		if (watch_fd >= 0) close( watch_fd );
+		watch_fd = -1;
+	}
+
+	signal( SIGHUP, hangup_handler );
+
+	watching = 1;
+	if (pthread_create( &watch_thread, NULL, rules_watch_thread, NULL )) {
+		fprintf(stderr, "rules_watch_start(): failed to start thread.\n");
+		watching = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void rules_watch_finish( void )
+{
+	if (!watching) return;
+	watching = 0;
+	pthread_join( watch_thread, NULL );
+
+	if (watch_fd >= 0) close( watch_fd );
+	watch_fd = -1;
+}
@@ -0,0 +1,98 @@
+/*
+
+	rules.h
+	Per-port detection rules for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef RULES_H
+#define RULES_H
+
+#include "settings.h"
+#include "goertzel.h"
+
+
+#define RULES_MAX			64		// Maximum number of ports monitored
+#define RULE_NAME_MAX		64		// Longest port name we register
+#define RULE_PATTERN_MAX	256		// Longest port name or pattern to connect to
+#define RULE_COMMAND_MAX	256		// Longest command
+#define RULE_MAX_STAGES		4		// Escalation stages per port
+
+
+typedef struct {
+	int after;							// Seconds the alarm must have lasted
+	char command[RULE_COMMAND_MAX];		// Shell command to run
+} stage_t;
+
+
+/*
+	Everything needed to monitor one port. There are no pointers in
+	here, so a whole ruleset is a single flat block of memory which can
+	be copied and swapped in one go.
+*/
+typedef struct {
+	char name[RULE_NAME_MAX];			// Name of our input port
+	char ref_name[RULE_NAME_MAX];		// Name of our reference port
+	char connect[RULE_PATTERN_MAX];		// Port(s) to connect to, may be a glob
+	char reference[RULE_PATTERN_MAX];	// Port(s) to connect reference port to
+
+	settings_t settings;				// Thresholds and periods
+	int reverse;						// If true, reverse behaviour
+	int adaptive;						// If true, silence threshold follows noise floor
+	float adaptive_offset;				// How far above the noise floor (dB)
+	int tone_count;						// Number of tones to detect
+	float tones[TONE_MAX_FREQS];		// Tone frequencies (Hz)
+	float flatness;						// Noise flatness level (0 = disabled)
+	float similarity;					// Reference similarity level (0 = disabled)
+
+	int stage_count;					// Number of escalation stages
+	stage_t stages[RULE_MAX_STAGES];	// Stage 0 runs first, sorted by 'after'
+} rule_t;
+
+typedef struct {
+	unsigned long generation;			// Bumped every time rules are published
+	int from_file;						// True if loaded from a rules file
+	int count;
+	rule_t rule[RULES_MAX];
+} ruleset_t;
+
+
+void rule_defaults( rule_t *rule, const char* name );
+int rule_same_detectors( const rule_t *a, const rule_t *b );
+const stage_t* rule_stage( const rule_t *rule, int elapsed );
+int rule_set( rule_t *rule, const char* key, const char* value );
+int rules_load( ruleset_t *rs, const char* path );
+int rules_find( const ruleset_t *rs, const char* name );
+
+/*
+	Rules are read by the monitor thread without a lock. Changes are
+	made to a private copy which is swapped in with a single atomic
+	pointer exchange; the old copy is freed once the monitor thread has
+	passed rules_quiescent(), so it can't still be using it.
+*/
+void rules_publish( ruleset_t *rs );
+void rules_lock( void );
+void rules_unlock( void );
+ruleset_t* rules_copy( void );
+const ruleset_t* rules_get( void );
+void rules_quiescent( void );
+
+// Returns non-zero if a set of rules can't be used
+typedef int (*rules_check_t)( const ruleset_t *rs );
+
+int rules_watch_start( const char* path, rules_check_t check );
+void rules_watch_finish( void );
+
+
+#endif
@@ -0,0 +1,107 @@
+/*
+
+	settings.c
+	Run-time adjustable detection settings for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#include "settings.h"
+
+
+// Names used by the control interface and rules files
+static const struct {
+	const char* name;
+	size_t offset;
+	int is_float;
+} fields[] = {
+	{ "silence_threshold", offsetof(settings_t, silence_theshold), 1 },
+	{ "silence_period", offsetof(settings_t, silence_period), 0 },
+	{ "nodynamic_threshold", offsetof(settings_t, nodynamic_theshold), 1 },
+	{ "nodynamic_period", offsetof(settings_t, nodynamic_period), 0 },
+	{ "grace_period", offsetof(settings_t, grace_period), 0 },
+	{ "tone_period", offsetof(settings_t, tone_period), 0 },
+	{ "noise_period", offsetof(settings_t, noise_period), 0 },
+	{ "loop_period", offsetof(settings_t, loop_period), 0 },
+	{ "mismatch_period", offsetof(settings_t, mismatch_period), 0 },
+	{ NULL, 0, 0 }
+};
+
+
+void settings_defaults( settings_t *s )
+{
+	s->silence_theshold = -40;
+	s->silence_period = 1;
+	s->nodynamic_theshold = 0;
+	s->nodynamic_period = 10;
+	s->grace_period = 0;
+	s->tone_period = 5;
+	s->noise_period = 10;
+	s->loop_period = 0;
+	s->mismatch_period = 10;
+}
+
+
+/* Change a setting by name. Returns non-zero if name or value is invalid. */
+int settings_set( settings_t *s, const char* name, const char* value )
+{
+	char *end = NULL;
+	int i;
+
+	for (i = 0; fields[i].name; i++) {
+		if (strcmp( fields[i].name, name ) == 0) break;
+	}
+	if (!fields[i].name) return -1;
+
+	if (fields[i].is_float) {
+		float f;
+		errno = 0;
+		f = strtod( value, &end );
+		if (end == value || *end || errno == ERANGE || !isfinite( f )) return -1;
+		*(float*)((char*)s + fields[i].offset) = f;
+	} else {
+		long l;
+		errno = 0;
+		l = strtol( value, &end, 10 );
+		if (end == value || *end || errno == ERANGE || l < 0 || l > INT_MAX) return -1;
+		*(int*)((char*)s + fields[i].offset) = l;
+	}
+
+	return 0;
+}
+
+
+/* Write all settings as 'name value' lines */
+int settings_format( const settings_t *s, char *buf, int len )
+{
+	int i, used = 0;
+
+	for (i = 0; fields[i].name && used < len; i++) {
+		const char* p = (const char*)s + fields[i].offset;
+		if (fields[i].is_float) {
+			used += snprintf( buf + used, len - used, "%s %g\n", fields[i].name, *(const float*)p );
+		} else {
+			used += snprintf( buf + used, len - used, "%s %d\n", fields[i].name, *(const int*)p );
+		}
+	}
+
+	return used < len ? used : len - 1;
+}
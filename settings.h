@@ -0,0 +1,42 @@
+/*
+
+	settings.h
+	Run-time adjustable detection settings for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+
+/* The thresholds and periods that can be changed while running */
+typedef struct {
+	float silence_theshold;		// Level considered silent (in dB)
+	int silence_period;			// Required period of silence for trigger
+	float nodynamic_theshold;	// Minimum allowed delta between peaks (in dB)
+	int nodynamic_period;		// Required period of no-dynamic for trigger
+	int grace_period;			// Period to wait before triggering again
+	int tone_period;			// Required period of tone for trigger
+	int noise_period;			// Required period of noise for trigger
+	int loop_period;			// Required period of looping for trigger
+	int mismatch_period;		// Required period of mismatch for trigger
+} settings_t;
+
+
+void settings_defaults( settings_t *s );
+int settings_set( settings_t *s, const char* name, const char* value );
+int settings_format( const settings_t *s, char *buf, int len );
+
+
+#endif
@@ -0,0 +1,135 @@
+/*
+
+	shmexport.c
+	Shared memory status segment for SilentJack: writing
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "shmexport.h"
+#include "shmstatus.h"
+
+
+static shmstatus_t *seg = NULL;
+static char seg_name[SHMSTATUS_NAME_MAX];
+
+
+int shmexport_create( const char* name )
+{
+	int fd, i;
+
+	if (strlen( name ) >= sizeof(seg_name) - 1) {
+		fprintf(stderr, "Shared memory name is too long: %s\n", name);
+		return -1;
+	}
+	snprintf( seg_name, sizeof(seg_name), "%s%s", name[0] == '/' ? "" : "/", name );
+
+	if ((fd = shm_open( seg_name, O_RDWR | O_CREAT, 0644 )) < 0) {
+		perror( seg_name );
+		return -1;
+	}
+	if (ftruncate( fd, sizeof(shmstatus_t) )) {
+		perror("shmexport_create(): ftruncate failed");
+		close( fd );
+		return -1;
+	}
+
+	seg = mmap( NULL, sizeof(shmstatus_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+	if (seg == MAP_FAILED) {
+		perror("shmexport_create(): mmap failed");
+		seg = NULL;
+		return -1;
+	}
+
+	// Readers check the magic last, so fill everything else in first
+	__atomic_store_n( &seg->magic, 0, __ATOMIC_RELEASE );
+	memset( (char*)seg + sizeof(seg->magic), 0, sizeof(shmstatus_t) - sizeof(seg->magic) );
+	seg->version = SHMSTATUS_VERSION;
+	seg->size = sizeof(shmstatus_t);
+	seg->port_size = sizeof(shmstatus_port_t);
+	seg->pid = getpid();
+	seg->event_types = EVENT_TYPES;
+	for (i = 0; i < EVENT_TYPES; i++) {
+		snprintf( seg->event_names[i], sizeof(seg->event_names[i]), "%s", event_names[i] );
+	}
+	__atomic_store_n( &seg->magic, SHMSTATUS_MAGIC, __ATOMIC_RELEASE );
+
+	return 0;
+}
+
+
+void shmexport_publish( const snapshot_t *snap )
+{
+	uint32_t sequence;
+	struct timeval now;
+	int i, j;
+
+	if (!seg) return;
+	gettimeofday( &now, NULL );
+
+	// Make the sequence odd for the duration of the update
+	sequence = seg->sequence;
+	__atomic_store_n( &seg->sequence, sequence + 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_RELEASE );
+
+	seg->updated = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+	seg->xruns = snap->engine.xruns;
+	seg->callbacks = snap->engine.callbacks;
+	seg->count = snap->count;
+	for (i = 0; i < snap->count; i++) {
+		const status_t *st = &snap->status[i];
+		shmstatus_port_t *p = &seg->port[i];
+
+		snprintf( p->port, sizeof(p->port), "%s", st->port );
+		p->connected = st->connected;
+		p->peakdb = st->peakdb;
+		p->rmsdb = st->rmsdb;
+		p->threshold = st->threshold;
+		p->silence_count = st->silence_count;
+		p->nodynamic_count = st->nodynamic_count;
+		p->in_grace = st->in_grace;
+		p->noise_count = st->noise_count;
+		p->loop_count = st->loop_count;
+		p->mismatch_count = st->mismatch_count;
+		for (j = 0; j < TONE_MAX_FREQS && j < SHMSTATUS_MAX_TONES; j++) {
+			p->tone_count[j] = st->tone_count[j];
+		}
+		p->seconds = st->seconds;
+		p->commands = st->commands;
+		for (j = 0; j < EVENT_TYPES && j < SHMSTATUS_MAX_EVENTS; j++) {
+			p->events[j] = st->events[j];
+		}
+	}
+
+	__atomic_store_n( &seg->sequence, sequence + 2, __ATOMIC_RELEASE );
+}
+
+
+void shmexport_destroy( void )
+{
+	if (!seg) return;
+
+	munmap( seg, sizeof(shmstatus_t) );
+	shm_unlink( seg_name );
+	seg = NULL;
+}
@@ -0,0 +1,37 @@
+/*
+
+	shmexport.h
+	Shared memory status segment for SilentJack: writing
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef SHMEXPORT_H
+#define SHMEXPORT_H
+
+#include "status.h"
+
+
+/*
+	Publishes the status snapshot in a POSIX shared memory segment
+	laid out as in shmstatus.h, protected by a sequence lock: the
+	sequence number is odd while an update is being written, so
+	readers retry rather than see a half written update.
+	Only the monitor thread writes to the segment.
+*/
+int shmexport_create( const char* name );
+void shmexport_publish( const snapshot_t *snap );
+void shmexport_destroy( void );
+
+
+#endif
@@ -0,0 +1,99 @@
+/*
+
+	shmstatus.c
+	Shared memory status segment for SilentJack: reading
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmstatus.h"
+
+
+#define READ_TRIES		1000
+
+
+/* Map the named segment, returns NULL if it isn't there or is incompatible */
+const shmstatus_t* shmstatus_attach( const char* name )
+{
+	shmstatus_t *seg;
+	struct stat st;
+	int fd;
+
+	if ((fd = shm_open( name, O_RDONLY, 0 )) < 0) {
+		perror( name );
+		return NULL;
+	}
+	if (fstat( fd, &st ) || st.st_size < (off_t)sizeof(shmstatus_t)) {
+		fprintf(stderr, "%s: segment is too small\n", name);
+		close( fd );
+		return NULL;
+	}
+
+	seg = mmap( NULL, sizeof(shmstatus_t), PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if (seg == MAP_FAILED) {
+		perror("shmstatus_attach(): mmap failed");
+		return NULL;
+	}
+
+	if (seg->magic != SHMSTATUS_MAGIC || seg->version != SHMSTATUS_VERSION ||
+	    seg->size != sizeof(shmstatus_t) || seg->port_size != sizeof(shmstatus_port_t)) {
+		fprintf(stderr, "%s: not a version %d SilentJack status segment\n", name, SHMSTATUS_VERSION);
+		munmap( seg, sizeof(shmstatus_t) );
+		return NULL;
+	}
+
+	return seg;
+}
+
+
+/* Take a consistent copy of the segment */
+int shmstatus_read( const shmstatus_t *seg, shmstatus_t *copy )
+{
+	int tries;
+
+	for (tries = 0; tries < READ_TRIES; tries++) {
+		uint32_t before = __atomic_load_n( &seg->sequence, __ATOMIC_ACQUIRE );
+		uint32_t count;
+
+		if (before & 1) continue;
+
+		// Only copy the ports in use
+		count = seg->count;
+		if (count > SHMSTATUS_MAX_PORTS) continue;
+		memcpy( copy, seg, offsetof(shmstatus_t, port) + count * sizeof(shmstatus_port_t) );
+
+		__atomic_thread_fence( __ATOMIC_ACQUIRE );
+		if (__atomic_load_n( &seg->sequence, __ATOMIC_RELAXED ) == before) {
+			copy->count = count;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+void shmstatus_detach( const shmstatus_t *seg )
+{
+	munmap( (void*)seg, sizeof(shmstatus_t) );
+}
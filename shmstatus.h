@@ -0,0 +1,92 @@
+/*
+
+	shmstatus.h
+	Shared memory status segment for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef SHMSTATUS_H
+#define SHMSTATUS_H
+
+#include <stdint.h>
+
+
+#define SHMSTATUS_MAGIC			0x534a5354	// 'SJST'
+#define SHMSTATUS_VERSION		1
+#define SHMSTATUS_MAX_PORTS		64
+#define SHMSTATUS_MAX_EVENTS	16
+#define SHMSTATUS_MAX_TONES		8
+#define SHMSTATUS_NAME_MAX		64
+
+
+/*
+	This header describes the segment on its own, so readers don't
+	need any other part of SilentJack. Only fixed size types are used.
+	The version is bumped whenever the layout changes; fields are only
+	ever added at the end of each structure, and 'size' and 'port_size'
+	give the sizes the writer was built with.
+*/
+typedef struct {
+	char port[SHMSTATUS_NAME_MAX];		// Name of the monitored port
+	int32_t connected;					// True if something is connected to it
+	float peakdb;						// Peak level in the last second (dB)
+	float rmsdb;						// RMS level in the last second (dB)
+	float threshold;					// Silence threshold in use (dB)
+
+	int32_t silence_count;				// Seconds of silence so far
+	int32_t nodynamic_count;			// Seconds of no-dynamic so far
+	int32_t in_grace;					// Seconds left in grace period
+	int32_t noise_count;				// Seconds of noise so far
+	int32_t loop_count;					// Seconds of looping so far
+	int32_t mismatch_count;				// Seconds of mismatch so far
+	int32_t tone_count[SHMSTATUS_MAX_TONES];	// Seconds of each tone so far
+
+	uint64_t seconds;					// Seconds monitored
+	uint64_t commands;					// Commands run
+	uint64_t events[SHMSTATUS_MAX_EVENTS];	// Number of each event triggered
+} shmstatus_port_t;
+
+typedef struct {
+	uint32_t magic;						// SHMSTATUS_MAGIC
+	uint32_t version;					// SHMSTATUS_VERSION
+	uint32_t size;						// sizeof(shmstatus_t)
+	uint32_t port_size;					// sizeof(shmstatus_port_t)
+
+	// Odd while the writer is part way through an update
+	uint32_t sequence;
+	uint32_t pid;						// Process ID of the writer
+
+	uint64_t updated;					// When last updated (microseconds since 1970)
+	uint64_t xruns;						// JACK xruns
+	uint64_t callbacks;					// JACK process callbacks
+
+	uint32_t event_types;				// Number of event types in use
+	uint32_t count;						// Number of ports in use
+	char event_names[SHMSTATUS_MAX_EVENTS][16];
+	shmstatus_port_t port[SHMSTATUS_MAX_PORTS];
+} shmstatus_t;
+
+
+/*
+	Reading the segment. The segment is mapped read-only, and
+	shmstatus_read() copies it without making any system calls,
+	retrying if the writer was part way through an update. It returns
+	non-zero if no consistent copy could be made.
+*/
+const shmstatus_t* shmstatus_attach( const char* name );
+int shmstatus_read( const shmstatus_t *seg, shmstatus_t *copy );
+void shmstatus_detach( const shmstatus_t *seg );
+
+
+#endif
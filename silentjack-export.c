@@ -0,0 +1,247 @@
+/*
+
+	silentjack-export.c
+	Export level history from SilentJack in a compact form
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "history.h"
+#include "levelcodec.h"
+
+
+#define MAX_PORTS		1024
+#define MAX_THREADS		64
+
+
+typedef struct {
+	const char* port;
+	level_encoder_t enc;
+	int result;
+} job_t;
+
+
+// Shared by the export threads
+static job_t jobs[MAX_PORTS];
+static int job_count = 0;
+static int next_job = 0;
+static int level = 1;
+static int64_t from_ms = 0;
+static int64_t to_ms = 0;
+
+
+static
+int add_level( void *arg, int64_t slot, const history_result_t *r )
+{
+	level_encoder_t *enc = (level_encoder_t*)arg;
+	level_t l;
+
+	l.slot = slot;
+	l.min = r->min;
+	l.max = r->max;
+	l.rms = r->rms;
+	return level_encoder_add( enc, &l );
+}
+
+
+/* Encode ports until there are none left */
+static
+void* export_thread( void *arg )
+{
+	int i;
+
+	while ((i = __atomic_fetch_add( &next_job, 1, __ATOMIC_RELAXED )) < job_count) {
+		job_t *job = &jobs[i];
+		const uint32_t res = history_resolution( level );
+
+		job->result = level_encoder_begin( &job->enc, job->port, res, from_ms / res );
+		if (job->result == 0) {
+			job->result = history_each( job->port, level, from_ms, to_ms, add_level, &job->enc );
+		}
+		if (job->result == 0) {
+			job->result = level_encoder_end( &job->enc );
+		}
+		if (job->result) {
+			fprintf(stderr, "Failed to export '%s'.\n", job->port);
+		}
+	}
+
+	return NULL;
+}
+
+
+/* Add every port with a history file in the directory */
+static
+void find_ports( const char* dir )
+{
+	struct dirent *entry;
+	DIR *d = opendir( dir );
+
+	if (!d) {
+		perror( dir );
+		exit(1);
+	}
+	while ((entry = readdir( d )) && job_count < MAX_PORTS) {
+		char *suffix = strstr( entry->d_name, ".history" );
+		if (!suffix || suffix[8] != '\0' || suffix == entry->d_name) continue;
+		*suffix = '\0';
+		jobs[job_count++].port = strdup( entry->d_name );
+	}
+	closedir( d );
+}
+
+
+static
+int decode( const char* path )
+{
+	FILE *file = strcmp( path, "-" ) ? fopen( path, "r" ) : stdin;
+	level_decoder_t dec;
+	level_t l;
+	int result;
+
+	if (!file) {
+		perror( path );
+		return 1;
+	}
+	if (level_decoder_open( &dec, file )) return 1;
+
+	printf("port,time,min,max,rms\n");
+	while ((result = level_decoder_next( &dec, &l )) > 0) {
+		const int64_t ms = l.slot * dec.resolution;
+		printf("%s,%lld.%03d,%.1f,%.1f,%.1f\n", dec.port,
+			(long long)(ms / 1000), (int)(ms % 1000), l.min, l.max, l.rms);
+	}
+	if (result < 0) fprintf(stderr, "%s: damaged export\n", path);
+
+	if (file != stdin) fclose( file );
+	return result < 0;
+}
+
+
+static
+int64_t parse_time( const char* arg )
+{
+	int64_t t = atoll( arg );
+	if (t <= 0) t += time(NULL);
+	return t * 1000;
+}
+
+
+/* Display how to use this program */
+static
+void usage()
+{
+	printf("%s version %s\n\n", PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Usage: silentjack-export -H <dir> [options] [PORT]...\n");
+	printf("       silentjack-export -d <file>\n");
+	printf("Options:  -H <dir>    Directory of level history (as given to silentjack -H)\n");
+	printf("          -r <ms>     Resolution: 100, 1000, 60000 or 3600000 (default 1000)\n");
+	printf("          -f <secs>   Start time, or relative to now if negative (default -86400)\n");
+	printf("          -t <secs>   End time, or relative to now if negative (default now)\n");
+	printf("          -j <n>      Number of ports to export at once (default 4)\n");
+	printf("          -o <file>   Write the export to this file (default stdout)\n");
+	printf("          -d <file>   Decode an export to CSV on stdout\n");
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[MAX_THREADS];
+	const char* dir = NULL;
+	const char* output = NULL;
+	FILE *out = stdout;
+	int thread_count = 4;
+	int opt, i, failed = 0;
+
+	from_ms = parse_time( "-86400" );
+	to_ms = parse_time( "0" );
+
+	while ((opt = getopt(argc, argv, "H:r:f:t:j:o:d:h")) != -1) {
+		switch (opt) {
+			case 'H': dir = optarg; break;
+			case 'r':
+				if ((level = history_level( atoi(optarg) )) < 0) usage();
+				break;
+			case 'f': from_ms = parse_time( optarg ); break;
+			case 't': to_ms = parse_time( optarg ); break;
+			case 'j': thread_count = abs(atoi(optarg)); break;
+			case 'o': output = optarg; break;
+			case 'd': return decode( optarg );
+			case 'h':
+			default:
+				usage();
+				break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (!dir || history_init( dir )) usage();
+	if (thread_count < 1) thread_count = 1;
+	if (thread_count > MAX_THREADS) thread_count = MAX_THREADS;
+
+	// Ports to export
+	if (argc) {
+		for (i = 0; i < argc && job_count < MAX_PORTS; i++) {
+			jobs[job_count++].port = argv[i];
+		}
+	} else {
+		find_ports( dir );
+	}
+
+	// Encode the ports in parallel
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create( &threads[i], NULL, export_thread, NULL )) {
+			fprintf(stderr, "Failed to start export thread.\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < thread_count; i++) {
+		pthread_join( threads[i], NULL );
+	}
+
+	// Then write them out in order
+	if (output && !(out = fopen( output, "w" ))) {
+		perror( output );
+		exit(1);
+	}
+	if (level_write_header( out )) exit(1);
+	for (i = 0; i < job_count; i++) {
+		if (jobs[i].result) {
+			failed = 1;
+		} else if (fwrite( jobs[i].enc.out.data, 1, jobs[i].enc.out.len, out ) != jobs[i].enc.out.len) {
+			perror("write failed");
+			exit(1);
+		}
+		level_encoder_free( &jobs[i].enc );
+	}
+
+	// Buffered writes may only fail when flushed
+	if (fflush( out ) || ferror( out ) || (out != stdout && fclose( out ))) {
+		perror( output ? output : "write failed" );
+		exit(1);
+	}
+
+	return failed;
+}
@@ -0,0 +1,187 @@
+/*
+
+	silentjack-sim.c
+	Run SilentJack's detectors on a scenario, in simulated time
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "config.h"
+#include "rules.h"
+#include "channel.h"
+#include "source.h"
+
+
+#define DEFAULT_SAMPLE_RATE		48000
+#define DEFAULT_BLOCK_SIZE		1024
+#define MAX_BLOCK_SIZE			8192
+
+
+/* Display how to use this program */
+static
+void usage()
+{
+	printf("%s version %s\n\n", PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Usage: silentjack-sim -s <scenario> [options]\n");
+	printf("Options:  -s <list>   Audio to play: kind[=arg]:secs,... (see README)\n");
+	printf("          -R <file>   Read the ports to simulate from this rules file\n");
+	printf("          -S <hz>     Sample rate (default %d)\n", DEFAULT_SAMPLE_RATE);
+	printf("          -b <n>      Frames per block (default %d)\n", DEFAULT_BLOCK_SIZE);
+	printf("          -l <db>     Trigger level (default -40 decibels)\n");
+	printf("          -p <secs>   Period of silence required (default 1 second)\n");
+	printf("          -a <db>     Adaptive trigger level, this far above noise floor\n");
+	printf("          -d <db>     No-dynamic trigger level (default disabled)\n");
+	printf("          -P <secs>   No-dynamic period (default 10 seconds)\n");
+	printf("          -g <secs>   Grace period (default 0 seconds)\n");
+	printf("          -t <hz>     Detect tone at this frequency (may be repeated)\n");
+	printf("          -T <secs>   Tone period (default 5 seconds)\n");
+	printf("          -f <ratio>  Noise spectral flatness level, 0 to 1 (default disabled)\n");
+	printf("          -F <secs>   Noise period (default 10 seconds)\n");
+	printf("          -L <secs>   Looping audio period (default disabled)\n");
+	printf("          -r          Enable reverse behaviour (detect noise)\n");
+	printf("          -v          Enable verbose mode\n");
+	exit(1);
+}
+
+
+/* Report an event at a simulated time, and what would be run for it */
+static
+void report( channel_t *ch, const event_t *ev, unsigned long now )
+{
+	const stage_t *stage = channel_alarm( ch, now );
+
+	printf("%02lu:%02lu:%02lu %s %s %d", now / 3600, now / 60 % 60, now % 60,
+		ch->rule.name, event_name( ev->type ), ev->duration);
+	if (ev->value != 0.0f) printf(" %g", ev->value);
+	printf(" -> %s\n", stage ? stage->command : "COMMAND");
+}
+
+
+int main(int argc, char *argv[])
+{
+	ruleset_t *rs = calloc( 1, sizeof(ruleset_t) );
+	channel_t *channels[RULES_MAX];
+	event_t events[EVENT_TYPES];
+	float buf[MAX_BLOCK_SIZE];
+	const char* scenario = NULL;
+	const char* rules_path = NULL;
+	unsigned int sample_rate = DEFAULT_SAMPLE_RATE;
+	unsigned int block_size = DEFAULT_BLOCK_SIZE;
+	unsigned long now = 0, total = 0;
+	int verbose = 0, ended = 0;
+	rule_t *rule;
+	source_t *src;
+	int opt, i, j, n;
+
+	if (!rs) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	// Parse command line arguments into a rule for a single port called 'in'
+	rs->count = 1;
+	rule = &rs->rule[0];
+	rule_defaults( rule, "in" );
+	while ((opt = getopt(argc, argv, "s:R:S:b:l:p:a:d:P:g:t:T:f:F:L:rvh")) != -1) {
+		switch (opt) {
+			case 's': scenario = optarg; break;
+			case 'R': rules_path = optarg; break;
+			case 'S': sample_rate = abs(atoi(optarg)); break;
+			case 'b': block_size = abs(atoi(optarg)); break;
+			case 'l': rule->settings.silence_theshold = atof(optarg); break;
+			case 'p': rule->settings.silence_period = abs(atoi(optarg)); break;
+			case 'a':
+				rule->adaptive_offset = atof(optarg);
+				rule->adaptive = 1;
+				break;
+			case 'd': rule->settings.nodynamic_theshold = atof(optarg); break;
+			case 'P': rule->settings.nodynamic_period = atof(optarg); break;
+			case 'g': rule->settings.grace_period = abs(atoi(optarg)); break;
+			case 't':
+				if (rule->tone_count >= TONE_MAX_FREQS || atof(optarg) <= 0.0f) usage();
+				rule->tones[ rule->tone_count++ ] = atof(optarg);
+				break;
+			case 'T': rule->settings.tone_period = abs(atoi(optarg)); break;
+			case 'f': rule->flatness = atof(optarg); break;
+			case 'F': rule->settings.noise_period = abs(atoi(optarg)); break;
+			case 'L': rule->settings.loop_period = abs(atoi(optarg)); break;
+			case 'r': rule->reverse = 1; break;
+			case 'v': verbose = 1; break;
+			case 'h':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	if (!scenario || !sample_rate || !block_size || block_size > MAX_BLOCK_SIZE) usage();
+	if (rules_path && rules_load( rs, rules_path )) exit(1);
+	for (i = 0; i < rs->count; i++) {
+		if (rs->rule[i].similarity > 0.0f) {
+			fprintf(stderr, "Port '%s': there is no reference to compare the scenario with.\n", rs->rule[i].name);
+			exit(1);
+		}
+	}
+	if (!(src = source_scenario( scenario, sample_rate ))) exit(1);
+
+	// Every port hears the same audio; the analysers run in this thread
+	for (i = 0; i < rs->count; i++) {
+		if (!(channels[i] = channel_create( &rs->rule[i], rs->from_file, sample_rate ))) exit(1);
+	}
+
+	// Each simulated second: a second of audio, then the detectors
+	while (!ended) {
+		unsigned int frames = 0, got;
+
+		while (frames < sample_rate) {
+			got = source_read( src, buf, sample_rate - frames < block_size ? sample_rate - frames : block_size );
+			if (got == 0) {
+				ended = 1;
+				break;
+			}
+			for (i = 0; i < rs->count; i++) {
+				channel_feed( channels[i], buf, NULL, got );
+			}
+			frames += got;
+		}
+		if (frames < sample_rate) break;
+		now++;
+
+		for (i = 0; i < rs->count; i++) {
+			channel_t *ch = channels[i];
+
+			worker_run( &ch->worker );
+			n = channel_tick( ch, verbose, events );
+			for (j = 0; j < n; j++) {
+				report( ch, &events[j], now );
+			}
+			total += n;
+		}
+	}
+
+	printf("%lu seconds simulated, %lu events\n", now, total);
+
+	for (i = 0; i < rs->count; i++) {
+		channel_free( NULL, channels[i] );
+	}
+	source_close( src );
+	free( rs );
+
+	return 0;
+}
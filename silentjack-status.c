@@ -0,0 +1,111 @@
+/*
+
+	silentjack-status.c
+	Display the status published by SilentJack in shared memory
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "config.h"
+#include "shmstatus.h"
+
+
+#define DEFAULT_SEGMENT_NAME	"/silentjack"
+#define STALE_SECONDS			5
+
+
+static
+void show( const shmstatus_t *s )
+{
+	struct timeval now;
+	unsigned int i, j;
+
+	gettimeofday( &now, NULL );
+	if ((uint64_t)now.tv_sec * 1000000 + now.tv_usec > s->updated + STALE_SECONDS * 1000000ULL) {
+		printf("Status is stale: SilentJack (pid %u) may not be running.\n", s->pid);
+	}
+
+	printf("%-20s %4s %8s %8s %8s %7s %5s %9s  %s\n",
+		"port", "conn", "peak", "rms", "thresh", "silence", "grace", "seconds", "events");
+	for (i = 0; i < s->count; i++) {
+		const shmstatus_port_t *p = &s->port[i];
+		printf("%-20s %4s %8.2f %8.2f %8.2f %7d %5d %9llu ",
+			p->port, p->connected ? "yes" : "no", p->peakdb, p->rmsdb, p->threshold,
+			p->silence_count, p->in_grace, (unsigned long long)p->seconds);
+		for (j = 0; j < s->event_types && j < SHMSTATUS_MAX_EVENTS; j++) {
+			if (p->events[j]) printf(" %s=%llu", s->event_names[j], (unsigned long long)p->events[j]);
+		}
+		printf("\n");
+	}
+	printf("xruns: %llu\n", (unsigned long long)s->xruns);
+}
+
+
+/* Display how to use this program */
+static
+void usage()
+{
+	printf("%s version %s\n\n", PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Usage: silentjack-status [options]\n");
+	printf("Options:  -s <name>   Name of the shared memory segment (default '%s')\n", DEFAULT_SEGMENT_NAME);
+	printf("          -w <secs>   Keep displaying the status every few seconds\n");
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char* name = DEFAULT_SEGMENT_NAME;
+	const shmstatus_t *seg = NULL;
+	static shmstatus_t copy;
+	int watch = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:w:h")) != -1) {
+		switch (opt) {
+			case 's': name = optarg; break;
+			case 'w': watch = abs(atoi(optarg)); break;
+			case 'h':
+			default:
+				usage();
+				break;
+		}
+	}
+
+	if (!(seg = shmstatus_attach( name ))) {
+		exit(1);
+	}
+
+	do {
+		if (shmstatus_read( seg, &copy )) {
+			fprintf(stderr, "Failed to read a consistent status.\n");
+			exit(1);
+		}
+		show( &copy );
+		if (watch) {
+			sleep( watch );
+			printf("\n");
+		}
+	} while (watch);
+
+	shmstatus_detach( seg );
+
+	return 0;
+}
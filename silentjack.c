@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -31,86 +33,229 @@
 #include <jack/jack.h>
 #include <getopt.h>
 #include "config.h"
-#include "db.h"
+#include "rules.h"
+#include "channel.h"
+#include "status.h"
+#include "control.h"
+#include "metrics.h"
+#include "shmexport.h"
+#include "eventlog.h"
+#include "journal.h"
+#include "history.h"
+#include "portindex.h"
+#include "rtsafe.h"
+#include "pcm.h"
 
 
 #define DEFAULT_CLIENT_NAME		"silentjack"
+#define XRUN_WINDOW				10		// Seconds of xruns to report with each event
+#define DEFAULT_STALL_PERIODS	16		// Periods the process thread may fall behind
+#define MAX_RECONNECT_DELAY		30		// Longest wait between attempts to reach JACK (seconds)
+#define RT_TABLE_SLOTS			4		// Arena slots kept for channel tables
+
+
+// The channels seen by the process thread
+typedef struct {
+	int count;
+	channel_t *channel[RULES_MAX];
+} channel_table_t;
 
 
 // *** Globals ***
-jack_port_t *input_port = NULL;		// Our single jack input port
-float peak = 0.0f;					// Current peak signal level (linear)
 int running = 1;					// SilentJack keeps running while true
+int server_lost = 0;				// Set when the JACK server goes away
 int quiet = 0;						// If true, don't send messages to stdout
 int verbose = 0;					// If true, send more messages to stdout
-int reverse = 0;                    // If true, reverse behaviour
+channel_t *channels[RULES_MAX];		// Ports being monitored
+int channel_count = 0;				// Number of ports being monitored
+channel_table_t *rt_table = NULL;	// Copy of channels for the process thread
+unsigned long rt_epoch = 0;			// Bumped after every process cycle
+engine_status_t engine;				// Callback timing and xruns
+unsigned int xrun_window[XRUN_WINDOW];	// Xruns in each of the last few seconds
+unsigned int stall_periods = DEFAULT_STALL_PERIODS;	// Tolerance before the engine counts as stalled
+struct timespec heartbeat_time;		// When the heartbeat was last checked (zero to start again)
+unsigned long long heartbeat_frames;	// Frames processed when it was last checked
+journal_state_t journal_states[RULES_MAX];	// Used when reading and writing the journal
+pcm_input_t pcm_input;				// Stream read instead of JACK
+pcm_input_t *pcm = NULL;			// Set when reading a stream
+time_t pcm_start = 0;				// Wall clock time the stream started
+uint64_t pcm_fed = 0;				// Frames of the stream given to the detectors
 
 
 
-/* Read and reset the recent peak sample */
+/* Callback called by JACK when audio is available.
+   Hands the audio to each channel. */
 static
-float read_peak()
+int process_peak(jack_nframes_t nframes, void *arg)
 {
-	float peakdb = lin2db(peak);
-	peak = 0.0f;
+	channel_table_t *table = __atomic_load_n( &rt_table, __ATOMIC_ACQUIRE );
+	struct timespec start, end;
+	int i;
+
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	rt_enter();
+
+	/* just incase the ports aren't registered yet */
+	if (table) {
+		for (i = 0; i < table->count; i++) {
+			channel_process( table->channel[i], nframes );
+		}
+	}
+
+	/* let the monitor thread know we are done with the table, and still alive */
+	__atomic_add_fetch( &rt_epoch, 1, __ATOMIC_RELEASE );
+	__atomic_store_n( &engine.frames, engine.frames + nframes, __ATOMIC_RELEASE );
+
+	rt_leave();
 
-	return peakdb;
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	engine_timing( &engine, (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec );
+
+	return 0;
 }
 
 
-/* Callback called by JACK when audio is available.
-   Stores value of peak sample */
+/* Give the process thread the current list of channels, and wait
+   until it has stopped using the old one */
 static
-int process_peak(jack_nframes_t nframes, void *arg)
+void publish_channels()
 {
-	jack_default_audio_sample_t *in;
-	unsigned int i;
+	channel_table_t *table = rt_alloc( sizeof(channel_table_t) );
+	channel_table_t *old;
+	unsigned long seen;
+	int tries = 500;
 
-	/* just incase the port isn't registered yet */
-	if (input_port == NULL) {
-		return 0;
+	// Without JACK there is no process thread; the main loop feeds the channels
+	if (pcm) {
+		rt_free( table );
+		return;
+	}
+
+	if (!table) {
+		perror("publish_channels(): rt_alloc failed");
+		exit(1);
+	}
+	table->count = channel_count;
+	memcpy( table->channel, channels, sizeof(channel_t*) * channel_count );
+
+	old = __atomic_exchange_n( &rt_table, table, __ATOMIC_ACQ_REL );
+	seen = __atomic_load_n( &rt_epoch, __ATOMIC_ACQUIRE );
+
+	// If JACK has stopped calling us, leaking the old table is the safe choice
+	if (old) {
+		while (__atomic_load_n( &rt_epoch, __ATOMIC_ACQUIRE ) == seen && --tries) {
+			usleep( 10000 );
+		}
+		if (tries) rt_free( old );
+	}
+}
+
+
+/*
+	Bring the channels into line with a new set of rules. Channels
+	whose rule still needs the same detectors are kept, along with their
+	counters; the rest are torn down and built again.
+	Returns non-zero if any channel failed to start or connect.
+*/
+static
+int apply_rules( jack_client_t *client, const ruleset_t *rs )
+{
+	channel_t *dropped[RULES_MAX];
+	int kept[RULES_MAX];
+	int dropped_count = 0;
+	int result = 0;
+	int i, j, idx;
+
+	memset( kept, 0, sizeof(kept) );
+
+	// Update the channels we can keep
+	for (i = 0, j = 0; i < channel_count; i++) {
+		channel_t *ch = channels[i];
+		idx = rules_find( rs, ch->rule.name );
+		if (idx >= 0 && rule_same_detectors( &ch->rule, &rs->rule[idx] )) {
+			int reconnect = strcmp( ch->rule.connect, rs->rule[idx].connect ) ||
+			                strcmp( ch->rule.reference, rs->rule[idx].reference );
+			channel_update( ch, &rs->rule[idx] );
+			if (reconnect && client) result |= channel_connect( client, ch, quiet );
+			kept[idx] = 1;
+			channels[j++] = ch;
+		} else {
+			if (!quiet) printf("Removing port '%s'.\n", ch->rule.name);
+			dropped[dropped_count++] = ch;
+		}
+	}
+	channel_count = j;
+
+	// Stop the process thread seeing the old channels before freeing them
+	if (dropped_count) {
+		publish_channels();
+		for (i = 0; i < dropped_count; i++) {
+			channel_free( client, dropped[i] );
+		}
 	}
 
-	/* get the audio samples, and find the peak sample */
-	in = (jack_default_audio_sample_t *) jack_port_get_buffer(input_port, nframes);
-	for (i = 0; i < nframes; i++) {
-		const float s = fabs(in[i]);
-		if (s > peak) {
-			peak = s;
+	// Start any new channels
+	for (idx = 0; idx < rs->count; idx++) {
+		channel_t *ch;
+		if (kept[idx]) continue;
+		if (!quiet) printf("Monitoring port '%s'.\n", rs->rule[idx].name);
+		if (pcm) {
+			ch = channel_create( &rs->rule[idx], rs->from_file, pcm->sample_rate );
+		} else {
+			ch = channel_new( client, &rs->rule[idx], rs->from_file );
+		}
+		if (!ch) {
+			result = -1;
+			continue;
 		}
+		channels[channel_count++] = ch;
+		if (client) result |= channel_connect( client, ch, quiet );
 	}
 
+	publish_channels();
+
+	return result;
+}
+
 
+/* Callback called by JACK when it misses a deadline */
+static
+int xrun_callback_jack(void *arg)
+{
+	__atomic_add_fetch( &engine.xruns, 1, __ATOMIC_RELAXED );
 	return 0;
 }
 
 
+/* Callback called by JACK when the period size changes */
+static
+int buffer_size_callback_jack(jack_nframes_t nframes, void *arg)
+{
+	__atomic_store_n( &engine.buffer_size, nframes, __ATOMIC_RELAXED );
+	return 0;
+}
 
 
-/* Connect the chosen port to ours */
+/* Callback called by JACK when the sample rate changes */
 static
-void connect_jack_port( jack_client_t *client, jack_port_t *port, const char* out )
+int sample_rate_callback_jack(jack_nframes_t nframes, void *arg)
 {
-	const char* in = jack_port_name( port );
-	int err;
-		
-	if (!quiet) printf("Connecting %s to %s\n", out, in);
-	
-	if ((err = jack_connect(client, out, in)) != 0) {
-		fprintf(stderr, "connect_jack_port(): failed to jack_connect() ports: %d\n",err);
-		exit(1);
-	}
+	__atomic_store_n( &engine.sample_rate, nframes, __ATOMIC_RELAXED );
+	return 0;
 }
 
 
+/* Callback called by JACK when the server shuts down or throws us out */
 static
 void shutdown_callback_jack(void *arg)
 {
-	running = 0;
+	__atomic_store_n( &server_lost, 1, __ATOMIC_RELEASE );
 }
 
+
+/* Register with JACK and start processing, returns NULL on failure */
 static
-jack_client_t* init_jack( const char * client_name, const char* connect_port ) 
+jack_client_t* open_jack( const char * client_name, int report )
 {
 	jack_status_t status;
 	jack_options_t options = JackNoStartServer;
@@ -118,34 +263,47 @@ jack_client_t* init_jack( const char * client_name, const char* connect_port )
 
 	// Register with Jack
 	if ((client = jack_client_open(client_name, options, &status)) == 0) {
-		fprintf(stderr, "Failed to start jack client: %d\n", status);
-		exit(1);
+		if (report) fprintf(stderr, "Failed to start jack client: %d\n", status);
+		return NULL;
 	}
 	if (!quiet) printf("JACK client registered as '%s'.\n", jack_get_client_name( client ) );
 
-	// Create our pair of output ports
-	if (!(input_port = jack_port_register(client, "in", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0))) {
-		fprintf(stderr, "Cannot register input port 'in'.\n");
-		exit(1);
-	}
-	
 	// Register shutdown callback
 	jack_on_shutdown (client, shutdown_callback_jack, NULL );
 
-	// Register the peak audio callback
+	// Register the peak audio callback, and set up its thread
 	jack_set_process_callback(client, process_peak, 0);
+	jack_set_thread_init_callback(client, rt_thread_init, 0);
+
+	// Count xruns, and watch for the engine being reconfigured
+	jack_set_xrun_callback(client, xrun_callback_jack, 0);
+	jack_set_buffer_size_callback(client, buffer_size_callback_jack, 0);
+	jack_set_sample_rate_callback(client, sample_rate_callback_jack, 0);
+
+	// Follow ports coming and going
+	portindex_init(client);
+
+	engine.buffer_size = jack_get_buffer_size(client);
+	engine.sample_rate = jack_get_sample_rate(client);
 
 	// Activate the client
 	if (jack_activate(client)) {
 		fprintf(stderr, "Cannot activate client.\n");
-		exit(1);
-	}
-	
-	// Connect up our input port ?
-	if (connect_port) {
-		connect_jack_port( client, input_port, connect_port );
+		jack_client_close(client);
+		return NULL;
 	}
-	
+	portindex_load(client);
+
+	return client;
+}
+
+
+static
+jack_client_t* init_jack( const char * client_name )
+{
+	jack_client_t *client = open_jack( client_name, 1 );
+
+	if (!client) exit(1);
 	return client;
 }
 
@@ -153,19 +311,30 @@ jack_client_t* init_jack( const char * client_name, const char* connect_port )
 static
 void finish_jack( jack_client_t *client )
 {
+	int i;
+
+	// Stop processing, then remove our ports
+	if (client) jack_deactivate(client);
+	for (i = 0; i < channel_count; i++) {
+		channel_free( client, channels[i] );
+	}
+	channel_count = 0;
+	rt_free( rt_table );
+
 	// Leave the Jack graph
-	jack_client_close(client);
+	if (client) jack_client_close(client);
 }
 
 
 static
-void run_command( int argc, char* argv[] )
+void run_command( status_t *st, int argc, char* argv[] )
 {
 	pid_t child;
-	int status;
+	int child_status;
 	
 	// No command to execute
 	if (argc<1) return;
+	st->commands++;
 	
 	// Exit successfully if command is called "exit"
 	if (argc==1 && strcmp(argv[0], "exit")==0) exit(0);
@@ -185,25 +354,492 @@ void run_command( int argc, char* argv[] )
 	}
 	
 	// Wait for process to end
-	if (waitpid( child, &status, 0)==-1) {
+	if (waitpid( child, &child_status, 0)==-1) {
+		perror("waitpid failed");
+	}
+}
+
+
+/* Run an escalation stage from the rules file using the shell.
+   The port and event are passed in the environment. */
+static
+void run_stage( status_t *st, const stage_t *stage, const char* port, int type )
+{
+	pid_t child;
+	int child_status;
+
+	st->commands++;
+
+	child = fork();
+	if (child==0) {
+		setenv( "SILENTJACK_PORT", port, 1 );
+		setenv( "SILENTJACK_EVENT", event_names[type], 1 );
+		execl( "/bin/sh", "sh", "-c", stage->command, (char*)NULL );
+		perror("execl failed");
+		exit(-1);
+	} else if (child==-1) {
+		perror("fork failed");
+		return;
+	}
+
+	if (waitpid( child, &child_status, 0)==-1) {
 		perror("waitpid failed");
 	}
 }
 
 
+/* Number of xruns in the last XRUN_WINDOW seconds */
+static
+unsigned int recent_xruns()
+{
+	unsigned int total = 0;
+	int i;
+
+	for (i = 0; i < XRUN_WINDOW; i++) total += xrun_window[i];
+	return total;
+}
+
+
+/* Log a change in the JACK engine itself */
+static
+void log_engine( int type, uint64_t frames, float value, float previous )
+{
+	eventlog_record_t rec;
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	memset( &rec, 0, sizeof(rec) );
+	rec.time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	rec.frames = frames;
+	rec.type = type;
+	rec.value = value;
+	rec.previous = previous;
+	rec.cpu_load = engine.cpu_load;
+	rec.xruns = recent_xruns();
+	eventlog_write( &rec );
+}
+
+
+/*
+	Once a second: count xruns, read the DSP load and look for changes
+	to the buffer size or sample rate, logging each one.
+	Returns non-zero if the sample rate has changed.
+*/
+static
+int check_engine( jack_client_t *client, jack_nframes_t frames, unsigned long tick )
+{
+	static unsigned long last_xruns = 0;
+	static unsigned int last_buffer_size = 0;
+	static unsigned int last_sample_rate = 0;
+	unsigned long xruns = __atomic_load_n( &engine.xruns, __ATOMIC_RELAXED );
+	unsigned int buffer_size = __atomic_load_n( &engine.buffer_size, __ATOMIC_RELAXED );
+	unsigned int sample_rate = __atomic_load_n( &engine.sample_rate, __ATOMIC_RELAXED );
+	int changed = 0;
+
+	engine.cpu_load = jack_cpu_load( client );
+	if (!last_buffer_size) last_buffer_size = buffer_size;
+	if (!last_sample_rate) last_sample_rate = sample_rate;
+
+	xrun_window[ tick % XRUN_WINDOW ] = xruns - last_xruns;
+	if (xruns != last_xruns) {
+		if (verbose) printf("%lu xrun(s), DSP load %1.1f%%.\n", xruns - last_xruns, engine.cpu_load);
+		log_engine( ENGINE_XRUN, frames, xruns - last_xruns, last_xruns );
+		last_xruns = xruns;
+	}
+
+	if (buffer_size != last_buffer_size) {
+		if (!quiet) printf("JACK buffer size changed from %u to %u frames.\n", last_buffer_size, buffer_size);
+		log_engine( ENGINE_BUFFER_SIZE, frames, buffer_size, last_buffer_size );
+		last_buffer_size = buffer_size;
+	}
+
+	if (sample_rate != last_sample_rate) {
+		if (!quiet) printf("JACK sample rate changed from %uHz to %uHz.\n", last_sample_rate, sample_rate);
+		log_engine( ENGINE_SAMPLE_RATE, frames, sample_rate, last_sample_rate );
+		last_sample_rate = sample_rate;
+		changed = 1;
+	}
+
+	return changed;
+}
+
+
+/*
+	Check the process thread's heartbeat against the wall clock. If it
+	has processed fewer frames than the time gone by calls for, by more
+	than stall_periods periods, JACK has stopped calling us and the
+	ports will look silent when they aren't.
+	Returns non-zero while the engine is stalled.
+*/
+static
+int check_stall( jack_nframes_t frames )
+{
+	unsigned long long processed = __atomic_load_n( &engine.frames, __ATOMIC_ACQUIRE );
+	unsigned int buffer_size = __atomic_load_n( &engine.buffer_size, __ATOMIC_RELAXED );
+	struct timespec now;
+	double expected, got;
+	int stalled;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	if (heartbeat_time.tv_sec == 0) {
+		heartbeat_time = now;
+		heartbeat_frames = processed;
+		return 0;
+	}
+
+	expected = ((now.tv_sec - heartbeat_time.tv_sec) + (now.tv_nsec - heartbeat_time.tv_nsec) / 1e9) * engine.sample_rate;
+	got = processed - heartbeat_frames;
+	stalled = (expected - got > (double)stall_periods * buffer_size);
+	heartbeat_time = now;
+	heartbeat_frames = processed;
+
+	if (stalled && !engine.stalled) {
+		if (!quiet) printf("**ENGINE STALLED**\n");
+		engine.stalls++;
+		log_engine( ENGINE_STALLED, frames, got, expected );
+	} else if (!stalled && engine.stalled) {
+		if (!quiet) printf("JACK engine has resumed.\n");
+		log_engine( ENGINE_RESUMED, frames, 0, 0 );
+	}
+	engine.stalled = stalled;
+
+	return stalled;
+}
+
+
+/* Tear down every channel, so that they are built again for a new sample rate */
+static
+void drop_channels( jack_client_t *client )
+{
+	channel_t *dropped[RULES_MAX];
+	int count = channel_count;
+	int i;
+
+	memcpy( dropped, channels, sizeof(channel_t*) * count );
+	channel_count = 0;
+	publish_channels();
+	for (i = 0; i < count; i++) {
+		channel_free( client, dropped[i] );
+	}
+}
+
+
+/* Connect a port that has appeared, or been disconnected, to any channel that wants it */
+static
+void follow_port( const char* name, void *arg )
+{
+	jack_client_t *client = arg;
+	int i;
+
+	for (i = 0; i < channel_count; i++) {
+		channel_follow( client, channels[i], name, quiet );
+	}
+}
+
+
+/* The JACK server has gone away: close the client, keeping the channels */
+static
+void lose_jack( jack_client_t *client )
+{
+	int i;
+
+	if (!quiet) printf("**JACK SERVER LOST**\n");
+	engine.disconnected = 1;
+	engine.outages++;
+	log_engine( ENGINE_SERVER_LOST, 0, 0, 0 );
+
+	// The process thread has gone with the server
+	jack_client_close( client );
+	rt_free( rt_table );
+	rt_table = NULL;
+
+	// Its ports went with it too
+	for (i = 0; i < channel_count; i++) {
+		channels[i]->port = NULL;
+		channels[i]->ref_port = NULL;
+		channels[i]->status.connected = 0;
+	}
+}
+
+
+/*
+	Try to get back to the JACK server after losing it. The channels
+	keep their detector state; they register the same ports again and
+	make the same connections, from their rules.
+	Returns NULL if the server still isn't there.
+*/
+static
+jack_client_t* reconnect_jack( const char * client_name, time_t lost )
+{
+	jack_client_t *client = open_jack( client_name, verbose );
+	int i;
+
+	if (!client) return NULL;
+
+	for (i = 0; i < channel_count; i++) {
+		if (channel_register( client, channels[i] )) {
+			for (i = 0; i < channel_count; i++) {
+				channels[i]->port = NULL;
+				channels[i]->ref_port = NULL;
+			}
+			jack_client_close( client );
+			return NULL;
+		}
+	}
+	publish_channels();
+	for (i = 0; i < channel_count; i++) {
+		channel_connect( client, channels[i], quiet );
+	}
+
+	if (!quiet) printf("Reconnected to JACK after %ld seconds.\n", (long)(time(NULL) - lost));
+	engine.disconnected = 0;
+	heartbeat_time.tv_sec = 0;
+	log_engine( ENGINE_RECONNECTED, jack_frame_time( client ), time(NULL) - lost, 0 );
+
+	return client;
+}
+
+
+/* The time now; a stream's comes from its sample count, since it may
+   arrive faster than real time */
+static
+void current_time( struct timeval *tv )
+{
+	gettimeofday( tv, NULL );
+	if (pcm) {
+		tv->tv_sec = pcm_start + pcm_fed / pcm->sample_rate;
+		tv->tv_usec = pcm_fed % pcm->sample_rate * 1000000ULL / pcm->sample_rate;
+	}
+}
+
+
+/* The same in milliseconds, for the level history */
+static
+int64_t current_ms( void )
+{
+	struct timeval tv;
+
+	current_time( &tv );
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/* Report something that was detected and run the right command for it */
+static
+void trigger( channel_t *ch, const event_t *ev, uint64_t frames, int argc, char* argv[] )
+{
+	const char* label = ch->label;
+	const stage_t *stage;
+	eventlog_record_t rec;
+	unsigned int xruns = recent_xruns();
+	struct timeval tv;
+	time_t now;
+
+	current_time( &tv );
+	now = tv.tv_sec;
+
+	if (!quiet) {
+		switch (ev->type) {
+			case EVENT_SILENCE: printf("%s**SILENCE**\n", label); break;
+			case EVENT_NOISY: printf("%s**NOISY**\n", label); break;
+			case EVENT_NO_DYNAMIC: printf("%s**NO DYNAMIC**\n", label); break;
+			case EVENT_TONE: printf("%s**TONE** %gHz\n", label, ev->value); break;
+			case EVENT_STEREO_IDENT: printf("%s**STEREO IDENT** %gHz\n", label, ev->value); break;
+			case EVENT_NOISE: printf("%s**NOISE NOT PROGRAM**\n", label); break;
+			case EVENT_LOOPING: printf("%s**LOOPING** %1.2f seconds\n", label, ev->value); break;
+			case EVENT_MISMATCH: printf("%s**MISMATCH**\n", label); break;
+			case EVENT_LATENCY_CHANGE:
+				printf("%s**LATENCY CHANGE** %1.1fms to %1.1fms\n", label, ev->previous, ev->value);
+				break;
+		}
+		if (verbose && xruns) {
+			printf("%s%u xrun(s) in the last %d seconds.\n", label, xruns, XRUN_WINDOW);
+		}
+	}
+	ch->status.events[ev->type]++;
+
+	// Log it
+	memset( &rec, 0, sizeof(rec) );
+	rec.time = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	rec.frames = frames;
+	snprintf( rec.port, sizeof(rec.port), "%s", ch->rule.name );
+	rec.type = ev->type;
+	rec.duration = ev->duration;
+	rec.peakdb = ch->status.peakdb;
+	rec.rmsdb = ch->status.rmsdb;
+	rec.threshold = ch->status.threshold;
+	rec.value = ev->value;
+	rec.previous = ev->previous;
+	rec.cpu_load = engine.cpu_load;
+	rec.xruns = xruns;
+	eventlog_write( &rec );
+
+	// Escalate the longer the alarm goes on
+	stage = channel_alarm( ch, now );
+	if (stage) {
+		run_stage( &ch->status, stage, ch->rule.name, ev->type );
+	} else {
+		run_command( &ch->status, argc, argv );
+	}
+}
+
+
+/* Pick up where a previous run left off */
+static
+void restore_journal( const char* path )
+{
+	struct timeval tv;
+	time_t now;
+	int64_t last = 0;
+	int count = journal_replay( path, journal_states, RULES_MAX, &last );
+	int i, j;
+
+	current_time( &tv );
+	now = tv.tv_sec;
+
+	for (i = 0; i < channel_count; i++) {
+		for (j = 0; j < count; j++) {
+			if (strcmp( journal_states[j].port, channels[i]->rule.name ) == 0) {
+				channel_restore( channels[i], &journal_states[j], last, now );
+				if (!quiet) printf("Resuming '%s' from journal.\n", channels[i]->rule.name);
+			}
+		}
+	}
+}
+
+
+/* Write down the state of every port that has changed, or of all
+   of them when a checkpoint is due. Returns non-zero if it failed. */
+static
+int update_journal( int checkpoint )
+{
+	struct timeval tv;
+	time_t now;
+	int count = 0, i;
+
+	current_time( &tv );
+	now = tv.tv_sec;
+
+	for (i = 0; i < channel_count; i++) {
+		journal_state_t *state = &journal_states[count];
+		channel_save( channels[i], state, now );
+		if (checkpoint || journal_changed( state, &channels[i]->journaled )) {
+			channels[i]->journaled = *state;
+			count++;
+		}
+	}
+
+	if (!checkpoint && count == 0) return 0;
+	return journal_append( checkpoint ? JOURNAL_CHECKPOINT : JOURNAL_UPDATE, journal_states, count );
+}
+
+
+/* Returns non-zero if the rules ask for something a stream can't give */
+static
+int check_pcm_rules( const ruleset_t *rs )
+{
+	int i;
+
+	if (rs->count > (int)pcm->channels) {
+		fprintf(stderr, "There are %d ports, but the stream only has %u channels.\n", rs->count, pcm->channels);
+		return -1;
+	}
+	for (i = 0; i < rs->count; i++) {
+		if (rs->rule[i].similarity > 0.0f) {
+			fprintf(stderr, "Port '%s': there is no reference to compare a stream with.\n", rs->rule[i].name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/*
+	Read the next second of the stream and feed it to the channels, in
+	blocks the size of a JACK period. With a rules file, each port takes
+	the next channel of the stream, with its levels as measured by the
+	reader; the samples are only turned into floats if some port looks
+	at them. Otherwise 'in' is metered on all the channels together,
+	and only given a mix of them if it looks at the samples.
+	Returns the number of frames, 0 once the stream has ended.
+*/
+static
+unsigned int feed_pcm( const ruleset_t *rs )
+{
+	int stream[RULES_MAX];
+	unsigned int nframes, i, n, block;
+	float peak = 0.0f, squares = 0.0f;
+	int c, idx;
+
+	pcm->convert = 0;
+	for (c = 0; c < channel_count; c++) {
+		stream[c] = rules_find( rs, channels[c]->rule.name );
+		if (stream[c] >= 0 && channel_needs_audio( channels[c] )) pcm->convert = 1;
+	}
+
+	nframes = pcm_read( pcm );
+	if (!rs->from_file && pcm->convert) pcm_mix( pcm, nframes );
+
+	for (i = 0, block = 0; i < nframes; i += PCM_BLOCK_SIZE, block++) {
+		n = nframes - i < PCM_BLOCK_SIZE ? nframes - i : PCM_BLOCK_SIZE;
+		pcm_fed = pcm->frames - nframes + i;
+		if (!rs->from_file) pcm_levels( pcm, block, &peak, &squares );
+		for (c = 0; c < channel_count; c++) {
+			if ((idx = stream[c]) < 0) {
+				continue;
+			} else if (!rs->from_file) {
+				channel_feed_levels( channels[c], pcm->convert ? pcm->mix + i : NULL, NULL, n, peak, squares );
+			} else {
+				channel_feed_levels( channels[c], pcm->convert ? pcm->audio[idx] + i : NULL, NULL, n,
+				                     pcm->peak[idx][block], pcm->squares[idx][block] );
+			}
+		}
+	}
+
+	pcm_fed = pcm->frames;
+
+	// The analysis runs here too, so it never falls behind a fast stream
+	for (c = 0; c < channel_count; c++) {
+		worker_run( &channels[c]->worker );
+	}
+
+	return nframes;
+}
+
+
 /* Display how to use this program */
 static
 void usage()
 {
 	printf("%s version %s\n\n", PACKAGE_NAME, PACKAGE_VERSION);
 	printf("Usage: silentjack [options] [COMMAND [ARG]...]\n");
-	printf("Options:  -c <port>   Connect to this port\n");
+	printf("Options:  -c <port>   Connect to this port, or ports matching a glob or /regex/\n");
 	printf("          -n <name>   Name of this client (default 'silentjack')\n");
 	printf("          -l <db>     Trigger level (default -40 decibels)\n");
 	printf("          -p <secs>   Period of silence required (default 1 second)\n");
+	printf("          -a <db>     Adaptive trigger level, this far above noise floor\n");
 	printf("          -d <db>     No-dynamic trigger level (default disabled)\n");
 	printf("          -P <secs>   No-dynamic period (default 10 seconds)\n");
 	printf("          -g <secs>   Grace period (default 0 seconds)\n");
+	printf("          -t <hz>     Detect tone at this frequency (may be repeated)\n");
+	printf("          -T <secs>   Tone period (default 5 seconds)\n");
+	printf("          -f <ratio>  Noise spectral flatness level, 0 to 1 (default disabled)\n");
+	printf("          -F <secs>   Noise period (default 10 seconds)\n");
+	printf("          -L <secs>   Looping audio period (default disabled)\n");
+	printf("          -x <ratio>  Similarity to reference port, 0 to 1 (default disabled)\n");
+	printf("          -X <secs>   Mismatch period (default 10 seconds)\n");
+	printf("          -C <port>   Connect reference port to this port\n");
+	printf("          -S <path>   Listen for control connections on this socket\n");
+	printf("          -R <file>   Read the ports to monitor from this rules file\n");
+	printf("          -M <addr>   Serve Prometheus metrics on [host:]port\n");
+	printf("          -s <name>   Publish status in this shared memory segment\n");
+	printf("          -E <file>   Log events to this file (see README for settings)\n");
+	printf("          -J <file>   Keep a journal of detector state in this file\n");
+	printf("          -H <dir>    Keep a history of levels in this directory\n");
+	printf("          -W <n>      Engine stall tolerance in periods (default %d)\n", DEFAULT_STALL_PERIODS);
+	printf("          -A <n>      Number of analysis threads (default one per CPU, up to 4)\n");
+	printf("          -i <file>   Read raw PCM from this file or pipe ('-' for stdin) instead of JACK\n");
 	printf("          -v          Enable verbose mode\n");
 	printf("          -q          Enable quiet mode\n");
 	printf("          -r          Enable reverse behaviour mode\n");
@@ -216,35 +852,84 @@ int main(int argc, char *argv[])
 {
 	jack_client_t *client = NULL;
 	const char* client_name = DEFAULT_CLIENT_NAME;
-	const char* connect_port = NULL;
-	float peakdb = 0.0f;			// The current peak signal level (in dB)
-	float last_peakdb = 0.0f;		// The previous peak signal level (in dB)
-	int silence_period = 1;			// Required period of silence for trigger
-	int nodynamic_period = 10;		// Required period of no-dynamic for trigger
-	int grace_period = 0;			// Period to wait before triggering again
-	float silence_theshold = -40;	// Level considered silent (in dB)
-	float nodynamic_theshold = 0;	// Minimum allowed delta between peaks (in dB)
-	int silence_count = 0;			// Number of seconds of silence detected
-	int nodynamic_count = 0;		// Number of seconds of no-dynamic detected
-	int in_grace = 0;				// Number of seconds left in grace
-	int opt;
-
-	// Make STDOUT unbuffered
-	setbuf(stdout, NULL);
-
-	// Parse command line arguments
-	while ((opt = getopt(argc, argv, "c:n:l:p:P:d:g:vqhr")) != -1) {
+	const char* control_path = NULL;
+	const char* rules_path = NULL;
+	const char* metrics_address = NULL;
+	const char* segment_name = NULL;
+	const char* eventlog_spec = NULL;
+	const char* journal_path = NULL;
+	time_t checkpointed = 0;		// When the journal was last checkpointed
+	uint64_t frames = 0;			// JACK frame time, or frames of the stream, this second
+	ruleset_t *initial = NULL;		// Rules from the command line or rules file
+	rule_t *rule = NULL;			// The single rule made from the command line
+	const ruleset_t *rs = NULL;		// Rules in use this second
+	unsigned long generation = 0;	// Generation of the rules the channels follow
+	unsigned long tick = 0;			// Seconds since starting
+	int stalled = 0;				// JACK has stopped calling the process callback
+	int analysis_threads = 0;		// Threads for the expensive detectors (0 for automatic)
+	time_t lost = 0;				// When the JACK server went away
+	time_t retry = 0;				// When to next try to reconnect to it
+	unsigned int delay = 1;			// Seconds between attempts to reconnect
+	event_t events[EVENT_TYPES];	// Things detected on a port this second
+	snapshot_t *snap = NULL;		// Status of every port, for the control socket
+	int opt, i, j, n;
+
+	// Make STDOUT line buffered, so each message is written in one go
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (!(initial = calloc( 1, sizeof(ruleset_t) )) || !(snap = calloc( 1, sizeof(snapshot_t) ))) {
+		perror("calloc failed");
+		exit(1);
+	}
+
+	// Parse command line arguments into a rule for a single port called 'in'
+	initial->count = 1;
+	rule = &initial->rule[0];
+	rule_defaults( rule, "in" );
+	strcpy( rule->ref_name, "ref" );
+	while ((opt = getopt(argc, argv, "c:n:l:p:a:P:d:g:t:T:f:F:L:x:X:C:S:R:M:s:E:J:H:W:A:i:vqhr")) != -1) {
 		switch (opt) {
-			case 'c': connect_port = optarg; break;
+			case 'c': snprintf( rule->connect, sizeof(rule->connect), "%s", optarg ); break;
 			case 'n': client_name = optarg; break;
-			case 'l': silence_theshold = atof(optarg); break;
-			case 'p': silence_period = fabs(atoi(optarg)); break;
-			case 'd': nodynamic_theshold = atof(optarg); break;
-			case 'P': nodynamic_period = atof(optarg); break;
-			case 'g': grace_period = fabs(atoi(optarg)); break;
+			case 'l': rule->settings.silence_theshold = atof(optarg); break;
+			case 'p': rule->settings.silence_period = fabs(atoi(optarg)); break;
+			case 'a':
+				rule->adaptive_offset = atof(optarg);
+				rule->adaptive = 1;
+				break;
+			case 'd': rule->settings.nodynamic_theshold = atof(optarg); break;
+			case 'P': rule->settings.nodynamic_period = atof(optarg); break;
+			case 'g': rule->settings.grace_period = fabs(atoi(optarg)); break;
+			case 't':
+				if (rule->tone_count >= TONE_MAX_FREQS || atof(optarg) <= 0.0f) {
+					fprintf(stderr, "Invalid tone frequency or too many tones: %s\n", optarg);
+					usage();
+				}
+				rule->tones[ rule->tone_count++ ] = atof(optarg);
+				break;
+			case 'T': rule->settings.tone_period = abs(atoi(optarg)); break;
+			case 'f': rule->flatness = atof(optarg); break;
+			case 'F': rule->settings.noise_period = abs(atoi(optarg)); break;
+			case 'L': rule->settings.loop_period = abs(atoi(optarg)); break;
+			case 'x': rule->similarity = atof(optarg); break;
+			case 'X': rule->settings.mismatch_period = abs(atoi(optarg)); break;
+			case 'C': snprintf( rule->reference, sizeof(rule->reference), "%s", optarg ); break;
+			case 'S': control_path = optarg; break;
+			case 'R': rules_path = optarg; break;
+			case 'M': metrics_address = optarg; break;
+			case 's': segment_name = optarg; break;
+			case 'E': eventlog_spec = optarg; break;
+			case 'J': journal_path = optarg; break;
+			case 'H': if (history_init( optarg )) exit(1); break;
+			case 'W': stall_periods = abs(atoi(optarg)); break;
+			case 'A': analysis_threads = abs(atoi(optarg)); break;
+			case 'i':
+				if (pcm_open( &pcm_input, optarg )) exit(1);
+				pcm = &pcm_input;
+				break;
 			case 'v': verbose = 1; break;
 			case 'q': quiet = 1; break;
-			case 'r': reverse = 1; break;			
+			case 'r': rule->reverse = 1; break;
 			case 'h':
 			default:
 				/* Show usage information */
@@ -262,110 +947,168 @@ int main(int argc, char *argv[])
     	usage();
 	}
 
-	// Initialise Jack
-	client = init_jack( client_name, connect_port );
+	// Replace the command line rule with the rules file?
+	if (rules_path && rules_load( initial, rules_path )) {
+		exit(1);
+	}
+	if (pcm && check_pcm_rules( initial )) {
+		exit(1);
+	}
+	rules_publish( initial );
+
+	// Set aside locked memory for everything the process thread touches
+	if (rt_arena_init( sizeof(channel_t) > sizeof(channel_table_t) ? sizeof(channel_t) : sizeof(channel_table_t),
+	                   RULES_MAX + RT_TABLE_SLOTS )) {
+		exit(1);
+	}
+
+	// Start the threads that run the expensive detectors
+	if (!pcm && worker_pool_start( analysis_threads )) {
+		exit(1);
+	}
+
+	// Initialise Jack, unless reading a stream
+	if (pcm) {
+		pcm_start = time(NULL);
+		history_clock( current_ms );
+	} else {
+		client = init_jack( client_name );
+	}
+
+	// Start monitoring; a single port given on the command line must work
+	rules_quiescent();
+	rs = rules_get();
+	generation = rs->generation;
+	if (apply_rules( client, rs ) && !rs->from_file) {
+		exit(1);
+	}
+
+	// Carry on from the journal, and start a new one
+	if (journal_path) {
+		restore_journal( journal_path );
+		if (journal_start( journal_path )) exit(1);
+	}
+
+	// Start watching for changes to the rules
+	if (rules_path && rules_watch_start( rules_path, pcm ? check_pcm_rules : NULL )) {
+		exit(1);
+	}
+
+	// Start listening for control connections
+	if (control_path && control_start( control_path )) {
+		exit(1);
+	}
+
+	// Start logging events
+	if (eventlog_spec && eventlog_start( eventlog_spec )) {
+		exit(1);
+	}
+
+	// Publish status in shared memory
+	if (segment_name && shmexport_create( segment_name )) {
+		exit(1);
+	}
+
+	// Start serving metrics
+	if (metrics_address && metrics_start( metrics_address )) {
+		exit(1);
+	}
 	
 	
 	// Main loop
 	while (running) {
 	
-		// Sleep for 1 second
-		usleep( 1000000 );
+		// A stream is its own clock: each second of it is a second.
+		// What is left at the end is less than one, so it isn't ticked.
+		if (pcm) {
+			if (feed_pcm( rs ) < pcm->sample_rate) break;
+			frames = pcm->frames;
+		} else {
+			usleep( 1000000 );
+		}
 		
-		// Are we in grace period ?
-		if (in_grace) {
-			in_grace--;
-			if (verbose) printf("%d seconds left in grace period.\n", in_grace);
-			continue;
+		// Keep trying to get back to the JACK server, backing off as we go
+		if (__atomic_exchange_n( &server_lost, 0, __ATOMIC_ACQ_REL )) {
+			lose_jack( client );
+			client = NULL;
+			lost = retry = time(NULL);
+			delay = 1;
 		}
-
-		// Check we are connected to something
-		if (jack_port_connected(input_port)==0) {
-			if (verbose) printf("Input port isn't connected to anything.\n");
-			continue;
+		if (!client && !pcm && time(NULL) >= retry) {
+			if (!(client = reconnect_jack( client_name, lost ))) {
+				delay = delay * 2 > MAX_RECONNECT_DELAY ? MAX_RECONNECT_DELAY : delay * 2;
+				retry = time(NULL) + delay;
+			}
 		}
-	
-	
-		// Read the recent peak (in decibels)
-		last_peakdb = peakdb;
-		peakdb = read_peak();
-		
-		
-		// Do silence detection?
-		if (silence_theshold) {
-			if (verbose) printf("peak: %2.2fdB", peakdb);
-		
-			// Is peak too low?
-			if (!reverse) {
-				if (peakdb < silence_theshold) {
-					silence_count++;
-					if (verbose) printf(" (%d seconds of silence)\n", silence_count);
-				} else {
-					if (verbose) printf(" (not silent)\n");
-					silence_count=0;
-				}
-			} else {
-				if (peakdb >= silence_theshold) {
-					silence_count++;
-					if (verbose) printf(" (%d seconds of noise)\n", silence_count);
-				} else {
-					if (verbose) printf(" (not noisy)\n");
-					silence_count=0;
-				}
+
+		// Look at the engine, rebuilding every channel if the sample rate changed
+		if (client) {
+			frames = jack_frame_time( client );
+			if (check_engine( client, frames, tick++ )) {
+				drop_channels( client );
+				generation = 0;
 			}
-			// Have we had enough seconds of silence?
-			if (silence_count >= silence_period) {
-				if (!reverse) {
-					if (!quiet) printf("**SILENCE**\n");
-				} else {
-					if (!quiet) printf("**NOISY**\n");
-				}
-				run_command( argc, argv );
-				silence_count = 0;
-				in_grace = grace_period;
+		}
+
+		// Pick up any new rules
+		rules_quiescent();
+		rs = rules_get();
+		if ((client || pcm) && rs->generation != generation) {
+			if (verbose) printf("Applying new rules.\n");
+			apply_rules( client, rs );
+			generation = rs->generation;
+			checkpointed = 0;
+		}
+
+		// Connect ports that have appeared since the last second
+		if (client) portindex_update( client, follow_port, client );
+
+		// Run the detectors on each port, unless JACK has stopped feeding them
+		stalled = pcm ? 0 : !client || check_stall( frames );
+		for (i = 0; i < channel_count; i++) {
+			channel_t *ch = channels[i];
+
+			n = stalled ? 0 : channel_tick( ch, verbose, events );
+			for (j = 0; j < n; j++) {
+				trigger( ch, &events[j], frames, argc, argv );
 			}
-			
+
+			memcpy( &snap->status[i], &ch->status, sizeof(status_t) );
 		}
-		
-		
-		// Do no-dynamic detection
-		if (nodynamic_theshold) {
-			
-			if (verbose) printf("delta: %2.2fdB", fabs(last_peakdb-peakdb));
-			
-			// Check the dynamic/delta between peaks
-			if (!reverse) {
-				if (fabs(last_peakdb-peakdb) < nodynamic_theshold) {
-					nodynamic_count++;
-					if (verbose) printf(" (%d seconds of no dynamic)\n", nodynamic_count);
-				} else {
-					if (verbose) printf(" (dynamic)\n");
-					nodynamic_count=0;
-				}
-			} else {
-				if (fabs(last_peakdb-peakdb) >= nodynamic_theshold) {
-					nodynamic_count++;
-					if (verbose) printf(" (%d seconds of no dynamic)\n", nodynamic_count);
-				} else {
-					if (verbose) printf(" (dynamic)\n");
-					nodynamic_count=0;
-				}
-			 }	
-			// Have we had enough seconds of no dynamic?
-			if (nodynamic_count >= nodynamic_period) {
-				if (!quiet) printf("**NO DYNAMIC**\n");
-				run_command( argc, argv );
-				nodynamic_count = 0;
-				in_grace = grace_period;
+		snap->count = channel_count;
+
+		// Keep the journal up to date
+		if (journal_path) {
+			int checkpoint = (time(NULL) - checkpointed >= JOURNAL_CHECKPOINT_SECS);
+			if (update_journal( checkpoint )) {
+				checkpointed = 0;
+			} else if (checkpoint) {
+				checkpointed = time(NULL);
 			}
 		}
+
+		engine.eventlog_dropped = eventlog_dropped();
+		engine_copy( &snap->engine, &engine );
+		status_publish( snap );
+		shmexport_publish( snap );
 	}
 
 
 	// Clean up
+	metrics_finish();
+	control_finish();
+	shmexport_destroy();
+	rules_watch_finish();
+	if (journal_path) update_journal( 1 );
+	journal_finish();
 	finish_jack( client );
+	worker_pool_finish();
+	rt_arena_finish();
+	portindex_finish();
+	eventlog_finish();
+	if (pcm) pcm_close( pcm );
+	free( snap );
 
 
 	return 0;
 }
-
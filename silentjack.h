@@ -0,0 +1,125 @@
+/*
+
+	silentjack.h
+	SilentJack's detectors as a library
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef SILENTJACK_H
+#define SILENTJACK_H
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define SJ_API_VERSION		2		// Bumped when anything below changes incompatibly
+#define SJ_EVENTS_MAX		32		// Room for event types added later
+
+
+// Things a detector can report (the same numbers as in event logs)
+enum {
+	SJ_EVENT_SILENCE = 0,
+	SJ_EVENT_NOISY,
+	SJ_EVENT_NO_DYNAMIC,
+	SJ_EVENT_TONE,
+	SJ_EVENT_STEREO_IDENT,
+	SJ_EVENT_NOISE,
+	SJ_EVENT_LOOPING,
+	SJ_EVENT_MISMATCH,
+	SJ_EVENT_LATENCY_CHANGE,
+	SJ_EVENT_TYPES
+};
+
+
+// Something that was detected, with any details
+typedef struct {
+	int type;					// One of SJ_EVENT_*
+	int duration;				// Seconds the condition lasted
+	float value;				// Tone frequency (Hz), loop period (s) or new latency (ms)
+	float previous;				// Previous latency (ms)
+	const char* command;		// Escalation stage's command, NULL for the default
+} sj_event_t;
+
+
+// State of a detector after the last sj_detector_tick()
+typedef struct {
+	int connected;				// Always true without JACK
+	float peakdb;				// Peak level in the last second (dB)
+	float rmsdb;				// RMS level in the last second (dB)
+	float threshold;			// Silence threshold in use (dB)
+	int silence_count;			// Seconds of silence (or noise, if reversed) so far
+	int nodynamic_count;		// Seconds of no dynamic so far
+	int in_grace;				// Seconds left in the grace period
+	int tone_count;				// Seconds of the longest running tone so far
+	int noise_count;			// Seconds of broadband noise so far
+	int loop_count;				// Seconds of looping audio so far
+	int mismatch_count;			// Seconds of not tracking the reference so far
+	unsigned long seconds;		// Seconds analysed
+	unsigned long dropped;		// Frames fed that there was no room to analyse
+	unsigned long events[SJ_EVENTS_MAX];	// Number of each event reported, by SJ_EVENT_*
+	unsigned long reserved[8];	// Zero, kept for later additions
+} sj_state_t;
+
+
+/*
+	A detector watches one stream of audio, with all the detectors
+	SilentJack would run on one port. Each one is independent, and any
+	number may be used at once, from different threads if need be (but
+	each one from a single thread at a time).
+*/
+typedef struct sj_detector sj_detector_t;
+
+
+/*
+	Create a detector. settings is a NULL terminated list of key and
+	value strings, the same as in a SilentJack rules file, such as
+	{ "silence_threshold", "-50", "tone", "1000", NULL }; NULL settings
+	gives the defaults. Returns NULL if a setting is invalid or there
+	isn't enough memory. Everything it will need is allocated here.
+*/
+sj_detector_t* sj_detector_new( const char* name, unsigned int sample_rate, const char* const* settings );
+
+/* Change settings that don't add or remove detectors (thresholds and
+   periods). Returns non-zero, changing nothing, if any are invalid. */
+int sj_detector_set( sj_detector_t *d, const char* const* settings );
+
+/* Analyse a block of audio. ref is the reference audio, and is
+   required if 'similarity' is set: without it (NULL) the audio isn't
+   compared with anything, and no MISMATCH is ever reported. Otherwise
+   ref is ignored and may be NULL. Doesn't allocate, lock or make
+   system calls. */
+void sj_detector_feed( sj_detector_t *d, const float *in, const float *ref, unsigned int nframes );
+
+/* Call after each second of audio: runs the detectors and fills in up
+   to max events, returning how many there were, which may be more
+   than max (the rest are counted in the state, but not filled in).
+   now is the caller's idea of the time in seconds, used for the
+   escalation stages. */
+int sj_detector_tick( sj_detector_t *d, time_t now, sj_event_t *events, int max );
+
+void sj_detector_state( const sj_detector_t *d, sj_state_t *state );
+void sj_detector_free( sj_detector_t *d );
+
+const char* sj_event_name( int type );
+int sj_api_version( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,234 @@
+/*
+
+	source.c
+	Audio sources that don't come from JACK
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "source.h"
+#include "db.h"
+
+
+/* Repeatable white noise, between -1 and 1 */
+static inline
+float noise( source_t *src )
+{
+	src->random = src->random * 1664525 + 1013904223;
+	return (int32_t)src->random / 2147483648.0f;
+}
+
+
+/* Parse one 'kind[=arg]:seconds' part of a scenario */
+static
+int parse_segment( source_t *src, segment_t *seg, char *text )
+{
+	char *secs = strrchr( text, ':' );
+	char *arg = strchr( text, '=' );
+
+	if (secs) *secs++ = '\0';
+	if (arg) *arg++ = '\0';
+
+	memset( seg, 0, sizeof(segment_t) );
+	if (strcmp( text, "silence" ) == 0) {
+		seg->kind = SEGMENT_SILENCE;
+	} else if (strcmp( text, "tone" ) == 0) {
+		seg->kind = SEGMENT_TONE;
+		seg->arg = arg ? atof( arg ) : 1000.0f;
+	} else if (strcmp( text, "noise" ) == 0) {
+		seg->kind = SEGMENT_NOISE;
+		seg->arg = arg ? atof( arg ) : -20.0f;
+	} else if (strcmp( text, "program" ) == 0) {
+		seg->kind = SEGMENT_PROGRAM;
+	} else if (strcmp( text, "loop" ) == 0) {
+		seg->kind = SEGMENT_LOOP;
+		seg->arg = arg ? atof( arg ) : 0.5f;
+		if (seg->arg <= 0.0f || seg->arg > SOURCE_LOOP_MAX) return -1;
+	} else if (strcmp( text, "file" ) == 0 && arg) {
+		seg->kind = SEGMENT_FILE;
+		snprintf( seg->path, sizeof(seg->path), "%s", arg );
+	} else {
+		return -1;
+	}
+
+	seg->frames = secs ? (uint64_t)(atof( secs ) * src->sample_rate) : 0;
+	if (seg->frames == 0 && seg->kind != SEGMENT_FILE) return -1;
+
+	return 0;
+}
+
+
+/* Fill a buffer with programme-like audio: dull noise whose level wanders */
+static
+void make_program( source_t *src, float *buf, unsigned int nframes )
+{
+	unsigned int i;
+
+	for (i = 0; i < nframes; i++) {
+		// A new target level every 50ms or so keeps the dynamics going
+		if ((src->position + i) % (src->sample_rate / 20) == 0) {
+			src->envelope = SOURCE_LEVEL * (0.1f + 0.9f * fabsf( noise( src ) ));
+		}
+		// Low-pass filtered, so it doesn't look like broadband noise
+		src->lowpass += 0.1f * (noise( src ) - src->lowpass);
+		buf[i] = 3.0f * src->lowpass * src->envelope;
+	}
+}
+
+
+/* Start playing the current segment */
+static
+int start_segment( source_t *src )
+{
+	segment_t *seg = &src->segment[ src->current ];
+
+	src->position = 0;
+	if (seg->kind == SEGMENT_FILE) {
+		if (!(src->file = fopen( seg->path, "rb" ))) {
+			perror( seg->path );
+			return -1;
+		}
+	} else if (seg->kind == SEGMENT_LOOP) {
+		const unsigned int len = seg->arg * src->sample_rate;
+		free( src->loop );
+		if (!(src->loop = malloc( sizeof(float) * len ))) {
+			perror("start_segment(): malloc failed");
+			return -1;
+		}
+		make_program( src, src->loop, len );
+	}
+
+	return 0;
+}
+
+
+/* Play the scenario: each segment in turn, then nothing more */
+static
+unsigned int read_scenario( source_t *src, float *buf, unsigned int nframes )
+{
+	segment_t *seg;
+	unsigned int i, n;
+
+	while (src->current < src->segment_count) {
+		seg = &src->segment[ src->current ];
+
+		n = nframes;
+		if (seg->frames && seg->frames - src->position < n) n = seg->frames - src->position;
+
+		switch (seg->kind) {
+			case SEGMENT_SILENCE:
+				memset( buf, 0, sizeof(float) * n );
+				break;
+			case SEGMENT_TONE:
+				for (i = 0; i < n; i++) {
+					buf[i] = SOURCE_LEVEL * sinf( 2.0f * M_PI * seg->arg *
+						((src->position + i) % src->sample_rate) / src->sample_rate );
+				}
+				break;
+			case SEGMENT_NOISE:
+				for (i = 0; i < n; i++) buf[i] = noise( src ) * db2lin( seg->arg );
+				break;
+			case SEGMENT_PROGRAM:
+				make_program( src, buf, n );
+				break;
+			case SEGMENT_LOOP: {
+				const unsigned int len = seg->arg * src->sample_rate;
+				for (i = 0; i < n; i++) buf[i] = src->loop[ (src->position + i) % len ];
+				break;
+			}
+			case SEGMENT_FILE:
+				n = fread( buf, sizeof(float), n, src->file );
+				if (n == 0) seg->frames = src->position;
+				break;
+		}
+
+		src->position += n;
+		if (n > 0) return n;
+
+		// On to the next segment
+		if (src->file) fclose( src->file );
+		src->file = NULL;
+		if (++src->current < src->segment_count && start_segment( src )) return 0;
+	}
+
+	return 0;
+}
+
+
+static
+void close_scenario( source_t *src )
+{
+	if (src->file) fclose( src->file );
+	free( src->loop );
+	free( src );
+}
+
+
+/*
+	A scenario is a comma separated list of 'kind[=arg]:seconds', played
+	in order: silence, tone=<hz>, noise=<dBFS>, program, loop=<secs>
+	and file=<path> (raw 32-bit float mono; the length may be left off
+	to play the whole file).
+*/
+source_t* source_scenario( const char* scenario, unsigned int sample_rate )
+{
+	source_t *src = calloc( 1, sizeof(source_t) );
+	char *copy = strdup( scenario );
+	char *part, *save = NULL;
+
+	if (!src || !copy) {
+		perror("source_scenario(): calloc failed");
+		exit(1);
+	}
+	src->sample_rate = sample_rate;
+	src->read = read_scenario;
+	src->close = close_scenario;
+	src->random = 1;
+
+	for (part = strtok_r( copy, ",", &save ); part; part = strtok_r( NULL, ",", &save )) {
+		if (src->segment_count >= SOURCE_SEGMENTS_MAX ||
+		    parse_segment( src, &src->segment[ src->segment_count ], part )) {
+			fprintf(stderr, "source_scenario(): invalid part of scenario: %s\n", part);
+			free( copy );
+			free( src );
+			return NULL;
+		}
+		src->segment_count++;
+	}
+	free( copy );
+
+	if (src->segment_count && start_segment( src )) {
+		close_scenario( src );
+		return NULL;
+	}
+
+	return src;
+}
+
+
+/* Read up to nframes of audio, returns 0 at the end */
+unsigned int source_read( source_t *src, float *buf, unsigned int nframes )
+{
+	return src->read( src, buf, nframes );
+}
+
+
+void source_close( source_t *src )
+{
+	if (src) src->close( src );
+}
@@ -0,0 +1,75 @@
+/*
+
+	source.h
+	Audio sources that don't come from JACK
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+#define SOURCE_SEGMENTS_MAX		64			// Parts of a scenario
+#define SOURCE_LEVEL			0.1f		// Level of synthetic signals (-20dBFS)
+#define SOURCE_LOOP_MAX			2.0f		// Longest repeating chunk (seconds)
+
+
+// Kinds of audio in a scenario
+enum {
+	SEGMENT_SILENCE,
+	SEGMENT_TONE,				// Sine wave, arg is the frequency (Hz)
+	SEGMENT_NOISE,				// White noise, arg is the level (dBFS)
+	SEGMENT_PROGRAM,			// Noise with a changing level, like programme
+	SEGMENT_LOOP,				// Programme repeating every arg seconds
+	SEGMENT_FILE				// Raw 32-bit float samples from a file
+};
+
+typedef struct {
+	int kind;
+	float arg;
+	char path[256];
+	uint64_t frames;			// Length (0 for a file means to the end)
+} segment_t;
+
+
+/*
+	A source hands out audio a block at a time, with no clock of its
+	own: whoever reads it decides how fast time passes.
+*/
+typedef struct source_s {
+	unsigned int sample_rate;
+	unsigned int (*read)( struct source_s *src, float *buf, unsigned int nframes );
+	void (*close)( struct source_s *src );
+
+	// Used by the scenario source
+	segment_t segment[SOURCE_SEGMENTS_MAX];
+	int segment_count;
+	int current;				// Segment being played
+	uint64_t position;			// Frames played of it
+	uint32_t random;			// Noise generator state, always starts the same
+	float envelope;				// Level of programme
+	float lowpass;				// Filter state for programme
+	float *loop;				// Chunk repeated by a loop segment
+	FILE *file;					// File being played
+} source_t;
+
+
+source_t* source_scenario( const char* scenario, unsigned int sample_rate );
+unsigned int source_read( source_t *src, float *buf, unsigned int nframes );
+void source_close( source_t *src );
+
+#endif
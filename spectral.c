@@ -0,0 +1,135 @@
+/*
+
+	spectral.c
+	Spectral flatness detector for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "spectral.h"
+#include "db.h"
+
+
+/* Allocate buffers and work out the window for this sample rate */
+int spectral_init( spectral_t *sp, unsigned int sample_rate )
+{
+	const unsigned int n = SPECTRAL_FFT_SIZE;
+	unsigned int i;
+
+	sp->sample_rate = sample_rate;
+	sp->fft = fft_new( n );
+	sp->window = malloc( sizeof(float) * n );
+	sp->buf = malloc( sizeof(float) * n );
+	sp->re = malloc( sizeof(float) * (n/2+1) );
+	sp->im = malloc( sizeof(float) * (n/2+1) );
+	if (!sp->fft || !sp->window || !sp->buf || !sp->re || !sp->im) {
+		fprintf(stderr, "spectral_init(): failed to allocate memory.\n");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		sp->window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / n);
+	}
+
+	sp->fill = 0;
+	sp->windows = 0;
+	sp->noisy = 0;
+	sp->flatness = 0.0f;
+	sp->centroid = 0.0f;
+
+	return 0;
+}
+
+
+/* Work out flatness and centroid of one window of audio */
+static
+void spectral_analyse( spectral_t *sp )
+{
+	const unsigned int n = SPECTRAL_FFT_SIZE;
+	const float bin_hz = (float)sp->sample_rate / n;
+	double log_sum = 0.0, sum = 0.0, weighted = 0.0, energy = 0.0;
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		energy += sp->buf[k] * sp->buf[k];
+		sp->buf[k] *= sp->window[k];
+	}
+
+	// Don't try to judge near-silence; that is the silence detector's job
+	if (lin2db( sqrt(energy / n) ) < SPECTRAL_MIN_LEVEL) return;
+
+	fft_real( sp->fft, sp->buf, sp->re, sp->im );
+
+	// Skip the DC bin
+	for (k = 1; k <= n/2; k++) {
+		const double p = sp->re[k] * sp->re[k] + sp->im[k] * sp->im[k] + 1e-20;
+		log_sum += log(p);
+		sum += p;
+		weighted += p * k * bin_hz;
+	}
+
+	// Geometric mean over arithmetic mean of the power spectrum
+	sp->flatness = exp(log_sum / (n/2)) / (sum / (n/2));
+	sp->centroid = weighted / sum;
+
+	if (sp->flatness >= sp->threshold) {
+		__atomic_add_fetch( &sp->noisy, 1, __ATOMIC_RELEASE );
+	}
+	__atomic_add_fetch( &sp->windows, 1, __ATOMIC_RELEASE );
+}
+
+
+/* Collect samples into windows and analyse each full window */
+void spectral_process( spectral_t *sp, const float *in, unsigned int nframes )
+{
+	while (nframes) {
+		unsigned int n = SPECTRAL_FFT_SIZE - sp->fill;
+		if (n > nframes) n = nframes;
+
+		memcpy( sp->buf + sp->fill, in, sizeof(float) * n );
+		sp->fill += n;
+		in += n;
+		nframes -= n;
+
+		if (sp->fill == SPECTRAL_FFT_SIZE) {
+			spectral_analyse( sp );
+			sp->fill = 0;
+		}
+	}
+}
+
+
+/* True if most windows since the last call looked like noise */
+int spectral_read( spectral_t *sp )
+{
+	unsigned int windows = __atomic_exchange_n( &sp->windows, 0, __ATOMIC_ACQ_REL );
+	unsigned int noisy = __atomic_exchange_n( &sp->noisy, 0, __ATOMIC_ACQ_REL );
+
+	return (windows && noisy * 2 > windows);
+}
+
+
+void spectral_finish( spectral_t *sp )
+{
+	fft_free( sp->fft );
+	free( sp->window );
+	free( sp->buf );
+	free( sp->re );
+	free( sp->im );
+	memset( sp, 0, sizeof(spectral_t) );
+}
@@ -0,0 +1,58 @@
+/*
+
+	spectral.h
+	Spectral flatness detector for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+
+#include "fft.h"
+
+
+#define SPECTRAL_FFT_SIZE		2048	// Samples per analysis window
+#define SPECTRAL_MIN_LEVEL		-70.0f	// Windows quieter than this are ignored (dB)
+
+
+/*
+	Runs in the analysis worker thread (see worker.h), never in the
+	process callback.
+*/
+typedef struct {
+	float threshold;				// Flatness considered to be noise (0 to 1)
+	unsigned int sample_rate;
+
+	fft_t *fft;
+	float *window;					// Hann window
+	float *buf;						// Windowed samples
+	unsigned int fill;				// Number of samples in buf
+	float *re;						// Spectrum (SPECTRAL_FFT_SIZE/2+1 bins)
+	float *im;
+
+	// Written by the worker thread, collected by spectral_read()
+	unsigned int windows;			// Windows analysed since last read
+	unsigned int noisy;				// Windows that looked like noise
+	float flatness;					// Flatness of last window (0 to 1)
+	float centroid;					// Spectral centroid of last window (Hz)
+} spectral_t;
+
+
+int spectral_init( spectral_t *sp, unsigned int sample_rate );
+void spectral_process( spectral_t *sp, const float *in, unsigned int nframes );
+int spectral_read( spectral_t *sp );
+void spectral_finish( spectral_t *sp );
+
+
+#endif
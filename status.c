@@ -0,0 +1,253 @@
+/*
+
+	status.c
+	Live detector state and counters for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "status.h"
+
+
+static snapshot_t latest;				// Most recently published status of all ports
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+const char* event_names[EVENT_TYPES] = {
+	"silence",
+	"noisy",
+	"no_dynamic",
+	"tone",
+	"stereo_ident",
+	"noise",
+	"looping",
+	"mismatch",
+	"latency_change"
+};
+
+
+const char* engine_event_names[ENGINE_EVENT_END - EVENT_TYPES] = {
+	"xrun",
+	"buffer_size",
+	"sample_rate",
+	"stalled",
+	"resumed",
+	"server_lost",
+	"reconnected"
+};
+
+
+// Buckets of the callback time histogram shown in the metrics (seconds),
+// each moved up to the edge of the timing bucket it falls in
+const float timing_bounds[TIMING_BOUNDS] = {
+	0.00005f, 0.0001f, 0.00025f, 0.0005f, 0.001f, 0.0025f, 0.005f, 0.01f, 0.025f
+};
+
+
+/* Name of a port or engine event */
+const char* event_name( int type )
+{
+	if (type >= 0 && type < EVENT_TYPES) return event_names[type];
+	if (type >= EVENT_TYPES && type < ENGINE_EVENT_END) return engine_event_names[type - EVENT_TYPES];
+	return "unknown";
+}
+
+
+static inline
+int timing_bucket( unsigned long long ns )
+{
+	const unsigned long long sub = 1 << TIMING_SUB_BITS;
+	int shift;
+
+	if (ns < sub) return ns;
+	if (ns >= (1ULL << 31)) ns = (1ULL << 31) - 1;
+
+	shift = 63 - __builtin_clzll( ns ) - TIMING_SUB_BITS;
+	return (shift + 1) * sub + ((ns >> shift) - sub);
+}
+
+
+/* Longest time (ns) counted in a bucket */
+unsigned long long timing_bucket_limit( int bucket )
+{
+	const unsigned long long sub = 1 << TIMING_SUB_BITS;
+	int shift;
+
+	if (bucket < (int)sub) return bucket;
+	shift = bucket / sub - 1;
+	return ((sub + bucket % sub + 1) << shift) - 1;
+}
+
+
+/* The edge of the bucket holding ns: the longest time (ns) counted in it */
+unsigned long long timing_bucket_edge( unsigned long long ns )
+{
+	return timing_bucket_limit( timing_bucket( ns ) );
+}
+
+
+/* Record how long a process callback took (called from process thread) */
+void engine_timing( engine_status_t *engine, unsigned long long ns )
+{
+	const int i = timing_bucket( ns );
+
+	__atomic_store_n( &engine->buckets[i], engine->buckets[i] + 1, __ATOMIC_RELAXED );
+	__atomic_store_n( &engine->nanoseconds, engine->nanoseconds + ns, __ATOMIC_RELAXED );
+	if (ns > engine->max_nanoseconds) {
+		__atomic_store_n( &engine->max_nanoseconds, ns, __ATOMIC_RELAXED );
+	}
+	__atomic_store_n( &engine->callbacks, engine->callbacks + 1, __ATOMIC_RELEASE );
+}
+
+
+/* Copy the engine counters while they are being written */
+void engine_copy( engine_status_t *dst, const engine_status_t *src )
+{
+	int i;
+
+	dst->callbacks = __atomic_load_n( &src->callbacks, __ATOMIC_ACQUIRE );
+	dst->xruns = __atomic_load_n( &src->xruns, __ATOMIC_RELAXED );
+	dst->nanoseconds = __atomic_load_n( &src->nanoseconds, __ATOMIC_RELAXED );
+	dst->max_nanoseconds = __atomic_load_n( &src->max_nanoseconds, __ATOMIC_RELAXED );
+	for (i = 0; i < TIMING_BUCKETS; i++) {
+		dst->buckets[i] = __atomic_load_n( &src->buckets[i], __ATOMIC_RELAXED );
+	}
+	dst->buffer_size = __atomic_load_n( &src->buffer_size, __ATOMIC_RELAXED );
+	dst->sample_rate = __atomic_load_n( &src->sample_rate, __ATOMIC_RELAXED );
+	dst->cpu_load = src->cpu_load;
+	dst->frames = __atomic_load_n( &src->frames, __ATOMIC_ACQUIRE );
+	dst->stalled = src->stalled;
+	dst->stalls = src->stalls;
+	dst->disconnected = src->disconnected;
+	dst->outages = src->outages;
+	dst->eventlog_dropped = src->eventlog_dropped;
+}
+
+
+/* Callback time (ns) below which the given percentage of callbacks fall */
+unsigned long long engine_percentile( const engine_status_t *engine, float percent )
+{
+	unsigned long total = 0, seen = 0;
+	int i;
+
+	for (i = 0; i < TIMING_BUCKETS; i++) total += engine->buckets[i];
+	if (total == 0) return 0;
+
+	for (i = 0; i < TIMING_BUCKETS; i++) {
+		seen += engine->buckets[i];
+		if (seen * 100.0 >= total * (double)percent) break;
+	}
+	return timing_bucket_limit( i < TIMING_BUCKETS ? i : TIMING_BUCKETS - 1 );
+}
+
+
+/* Number of callbacks that certainly took no longer than ns */
+unsigned long engine_count_below( const engine_status_t *engine, unsigned long long ns )
+{
+	unsigned long count = 0;
+	int i;
+
+	for (i = 0; i < TIMING_BUCKETS && timing_bucket_limit( i ) <= ns; i++) {
+		count += engine->buckets[i];
+	}
+	return count;
+}
+
+
+/* Write the engine statistics as 'name value' lines */
+int engine_format( const engine_status_t *e, char *buf, int len )
+{
+	int used = snprintf( buf, len,
+		"xruns %lu\n"
+		"cpu_load %.2f\n"
+		"buffer_size %u\n"
+		"sample_rate %u\n"
+		"callbacks %lu\n"
+		"stalled %d\n"
+		"stalls %lu\n"
+		"disconnected %d\n"
+		"outages %lu\n"
+		"eventlog_dropped %lu\n"
+		"callback_p50_us %.1f\n"
+		"callback_p99_us %.1f\n"
+		"callback_p999_us %.1f\n"
+		"callback_max_us %.1f\n",
+		e->xruns, e->cpu_load, e->buffer_size, e->sample_rate, e->callbacks,
+		e->stalled, e->stalls, e->disconnected, e->outages, e->eventlog_dropped,
+		engine_percentile( e, 50.0f ) / 1000.0, engine_percentile( e, 99.0f ) / 1000.0,
+		engine_percentile( e, 99.9f ) / 1000.0, e->max_nanoseconds / 1000.0 );
+
+	return used < len ? used : len - 1;
+}
+
+
+/* Write the status as 'name value' lines */
+int status_format( const status_t *st, char *buf, int len )
+{
+	int used = 0, i;
+
+	used += snprintf( buf + used, len - used,
+		"port %s\n"
+		"connected %d\n"
+		"peak %.2f\n"
+		"rms %.2f\n"
+		"threshold %.2f\n"
+		"silence_count %d\n"
+		"nodynamic_count %d\n"
+		"in_grace %d\n"
+		"noise_count %d\n"
+		"loop_count %d\n"
+		"mismatch_count %d\n"
+		"seconds %lu\n"
+		"commands %lu\n"
+		"analysis_dropped %lu\n"
+		"analysis_overruns %lu\n",
+		st->port, st->connected, st->peakdb, st->rmsdb, st->threshold,
+		st->silence_count, st->nodynamic_count, st->in_grace,
+		st->noise_count, st->loop_count, st->mismatch_count,
+		st->seconds, st->commands, st->analysis_dropped,
+		st->analysis_overruns );
+
+	for (i = 0; i < EVENT_TYPES && used < len; i++) {
+		used += snprintf( buf + used, len - used, "events_%s %lu\n", event_names[i], st->events[i] );
+	}
+
+	return used < len ? used : len - 1;
+}
+
+
+/* Called by the monitor thread once a second */
+void status_publish( const snapshot_t *snap )
+{
+	pthread_mutex_lock( &snapshot_lock );
+	latest.count = snap->count;
+	memcpy( latest.status, snap->status, sizeof(status_t) * snap->count );
+	latest.engine = snap->engine;
+	pthread_mutex_unlock( &snapshot_lock );
+}
+
+
+/* Consistent copy of the status of every port */
+void status_snapshot( snapshot_t *snap )
+{
+	pthread_mutex_lock( &snapshot_lock );
+	snap->count = latest.count;
+	memcpy( snap->status, latest.status, sizeof(status_t) * latest.count );
+	snap->engine = latest.engine;
+	pthread_mutex_unlock( &snapshot_lock );
+}
@@ -0,0 +1,146 @@
+/*
+
+	status.h
+	Live detector state and counters for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include "goertzel.h"
+#include "rules.h"
+
+
+// Things that SilentJack can detect
+enum {
+	EVENT_SILENCE = 0,
+	EVENT_NOISY,
+	EVENT_NO_DYNAMIC,
+	EVENT_TONE,
+	EVENT_STEREO_IDENT,
+	EVENT_NOISE,
+	EVENT_LOOPING,
+	EVENT_MISMATCH,
+	EVENT_LATENCY_CHANGE,
+	EVENT_TYPES
+};
+
+extern const char* event_names[EVENT_TYPES];
+
+
+// Something that was detected, with any details
+typedef struct {
+	int type;
+	int duration;		// Seconds the condition lasted
+	float value;		// Tone frequency (Hz), loop period (s) or new latency (ms)
+	float previous;		// Previous latency (ms)
+} event_t;
+
+
+/*
+	Written only by the monitor thread. Other threads get a consistent
+	copy of every port's status through the snapshot functions below.
+*/
+typedef struct {
+	char port[RULE_NAME_MAX];		// Name of the monitored port
+	int connected;					// True if something is connected to it
+	float peakdb;					// Peak level in the last second (dB)
+	float rmsdb;					// RMS level in the last second (dB)
+	float threshold;				// Silence threshold in use (dB)
+
+	int silence_count;				// Number of seconds of silence detected
+	int nodynamic_count;			// Number of seconds of no-dynamic detected
+	int in_grace;					// Number of seconds left in grace
+	int tone_count[TONE_MAX_FREQS];	// Number of seconds each tone detected
+	int noise_count;				// Number of seconds of noise detected
+	int loop_count;					// Number of seconds of looping detected
+	int mismatch_count;				// Number of seconds of mismatch detected
+
+	unsigned long seconds;			// Seconds monitored
+	unsigned long events[EVENT_TYPES];	// Number of each event triggered
+	unsigned long commands;			// Number of times COMMAND was run
+	unsigned long analysis_dropped;	// Frames the analysis threads had no room for
+	unsigned long analysis_overruns;	// Process callbacks whose audio didn't fit
+} status_t;
+
+
+/*
+	Callback times are counted in a log-linear histogram, like HDR
+	histograms: each power of two of nanoseconds is split into
+	2^TIMING_SUB_BITS equal buckets, so every time is recorded to
+	within 12.5% from 1ns to over a second, with no search.
+*/
+#define TIMING_SUB_BITS		3
+#define TIMING_BUCKETS		256
+#define TIMING_BOUNDS		9			// Buckets shown in the metrics
+
+extern const float timing_bounds[TIMING_BOUNDS];
+
+
+// Things that happen to JACK rather than to a port
+enum {
+	ENGINE_XRUN = EVENT_TYPES,
+	ENGINE_BUFFER_SIZE,
+	ENGINE_SAMPLE_RATE,
+	ENGINE_STALLED,
+	ENGINE_RESUMED,
+	ENGINE_SERVER_LOST,
+	ENGINE_RECONNECTED,
+	ENGINE_EVENT_END
+};
+
+extern const char* engine_event_names[ENGINE_EVENT_END - EVENT_TYPES];
+
+
+/* Written by the process thread and JACK callbacks, never reset */
+typedef struct {
+	unsigned long xruns;					// Number of xruns reported by JACK
+	unsigned long callbacks;				// Number of process callbacks
+	unsigned long long frames;				// Frames processed, the process thread's heartbeat
+	unsigned long long nanoseconds;			// Total time spent in process callbacks
+	unsigned long long max_nanoseconds;		// Longest process callback
+	unsigned long buckets[TIMING_BUCKETS];	// Histogram of process callback times
+	unsigned int buffer_size;				// Frames per process callback
+	unsigned int sample_rate;				// Sample rate (Hz)
+	float cpu_load;							// JACK's DSP load (percent)
+	int stalled;							// Process callbacks have stopped keeping up
+	unsigned long stalls;					// Number of times the engine has stalled
+	int disconnected;						// The JACK server has gone away
+	unsigned long outages;					// Number of times the JACK server has gone away
+	unsigned long eventlog_dropped;			// Events the event log had no room for
+} engine_status_t;
+
+
+typedef struct {
+	int count;
+	status_t status[RULES_MAX];
+	engine_status_t engine;
+} snapshot_t;
+
+
+void engine_timing( engine_status_t *engine, unsigned long long ns );
+void engine_copy( engine_status_t *dst, const engine_status_t *src );
+unsigned long long timing_bucket_limit( int bucket );
+unsigned long long timing_bucket_edge( unsigned long long ns );
+unsigned long long engine_percentile( const engine_status_t *engine, float percent );
+unsigned long engine_count_below( const engine_status_t *engine, unsigned long long ns );
+int engine_format( const engine_status_t *engine, char *buf, int len );
+const char* event_name( int type );
+int status_format( const status_t *st, char *buf, int len );
+void status_publish( const snapshot_t *snap );
+void status_snapshot( snapshot_t *snap );
+
+
+#endif
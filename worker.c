@@ -0,0 +1,300 @@
+/*
+
+	worker.c
+	Pool of analysis worker threads for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "worker.h"
+
+
+// One thread of the pool, and the channels it looks after
+typedef struct {
+	pthread_t thread;
+	pthread_mutex_t lock;			// Held while the job list is used or changed
+	int running;
+	int count;
+	worker_t *jobs[WORKER_JOBS_MAX];
+} pool_thread_t;
+
+
+static pool_thread_t pool[WORKER_THREADS_MAX];
+static int pool_size = 0;
+
+
+
+/* Copy samples into a ring through its write vector, or silence if in
+   is NULL; there must be room */
+static inline
+void ring_put( jack_ringbuffer_t *rb, const float *in, size_t bytes )
+{
+	jack_ringbuffer_data_t vec[2];
+	size_t first;
+
+	jack_ringbuffer_get_write_vector( rb, vec );
+	first = bytes < vec[0].len ? bytes : vec[0].len;
+	if (in) {
+		memcpy( vec[0].buf, in, first );
+		if (bytes > first) memcpy( vec[1].buf, (const char*)in + first, bytes - first );
+	} else {
+		memset( vec[0].buf, 0, first );
+		if (bytes > first) memset( vec[1].buf, 0, bytes - first );
+	}
+	jack_ringbuffer_write_advance( rb, bytes );
+}
+
+
+/* The next block in a ring, read in place unless it wraps around the end */
+static
+const float* ring_peek( jack_ringbuffer_t *rb, float *spare, size_t bytes )
+{
+	jack_ringbuffer_data_t vec[2];
+
+	jack_ringbuffer_get_read_vector( rb, vec );
+	if (vec[0].len >= bytes) return (const float*)vec[0].buf;
+
+	memcpy( spare, vec[0].buf, vec[0].len );
+	memcpy( (char*)spare + vec[0].len, vec[1].buf, bytes - vec[0].len );
+	return spare;
+}
+
+
+/* Analyse up to WORKER_BATCH blocks. Returns non-zero if there were any. */
+static
+int worker_drain( worker_t *w )
+{
+	const size_t bytes = sizeof(float) * WORKER_BLOCK_SIZE;
+	int blocks;
+
+	for (blocks = 0; blocks < WORKER_BATCH; blocks++) {
+		const float *block;
+
+		if (jack_ringbuffer_read_space( w->ring ) < bytes) break;
+
+		block = ring_peek( w->ring, w->block, bytes );
+		if (w->spectral) spectral_process( w->spectral, block, WORKER_BLOCK_SIZE );
+		if (w->loop) loop_process( w->loop, block, WORKER_BLOCK_SIZE );
+
+		if (w->ref_ring) {
+			const float *ref = ring_peek( w->ref_ring, w->ref_block, bytes );
+			xcorr_process( w->xcorr, block, ref, WORKER_BLOCK_SIZE );
+			jack_ringbuffer_read_advance( w->ref_ring, bytes );
+		}
+
+		// Only now can the process thread write over it
+		jack_ringbuffer_read_advance( w->ring, bytes );
+	}
+
+	return blocks;
+}
+
+
+static
+void* pool_thread( void *arg )
+{
+	pool_thread_t *t = (pool_thread_t*)arg;
+
+	while (t->running) {
+		int busy = 0, i;
+
+		pthread_mutex_lock( &t->lock );
+		for (i = 0; i < t->count; i++) {
+			busy |= worker_drain( t->jobs[i] );
+		}
+		pthread_mutex_unlock( &t->lock );
+
+		if (!busy) usleep( 10000 );
+	}
+
+	return NULL;
+}
+
+
+/* Tie a pool thread to a CPU of its own, leaving CPU 0 to JACK.
+   Without a CPU each, the threads are left to the scheduler. */
+static
+void pin_thread( pool_thread_t *t, int index )
+{
+	const long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+	cpu_set_t set;
+
+	if (cpus < 2 || pool_size > cpus - 1) return;
+
+	CPU_ZERO( &set );
+	CPU_SET( cpus - 1 - index, &set );
+	pthread_setaffinity_np( t->thread, sizeof(set), &set );
+}
+
+
+/* Start the analysis threads. 0 threads picks one per CPU, up to 4. */
+int worker_pool_start( int threads )
+{
+	int i;
+
+	if (threads <= 0) {
+		threads = sysconf( _SC_NPROCESSORS_ONLN );
+		if (threads > 4) threads = 4;
+		if (threads < 1) threads = 1;
+	}
+	if (threads > WORKER_THREADS_MAX) threads = WORKER_THREADS_MAX;
+
+	pool_size = threads;
+	for (i = 0; i < pool_size; i++) {
+		pool_thread_t *t = &pool[i];
+
+		pthread_mutex_init( &t->lock, NULL );
+		t->count = 0;
+		t->running = 1;
+		if (pthread_create( &t->thread, NULL, pool_thread, t )) {
+			fprintf(stderr, "worker_pool_start(): failed to start analysis thread.\n");
+			t->running = 0;
+			pool_size = i;
+			return -1;
+		}
+		pin_thread( t, i );
+	}
+
+	return 0;
+}
+
+
+int worker_pool_size()
+{
+	return pool_size;
+}
+
+
+void worker_pool_finish()
+{
+	int i;
+
+	for (i = 0; i < pool_size; i++) {
+		pool[i].running = 0;
+		pthread_join( pool[i].thread, NULL );
+		pthread_mutex_destroy( &pool[i].lock );
+	}
+	pool_size = 0;
+}
+
+
+/*
+	Each ring holds as much audio as can arrive while the analysis
+	thread is busy elsewhere, plus a period and a block; JACK rounds
+	it up to a power of two, which is always a whole number of blocks.
+*/
+int worker_init( worker_t *w, unsigned int sample_rate )
+{
+	const size_t frames = (size_t)sample_rate * WORKER_LATENCY_MS / 1000 + WORKER_PERIOD_MAX + WORKER_BLOCK_SIZE;
+	const size_t size = sizeof(float) * frames;
+
+	w->ring = jack_ringbuffer_create( size );
+	if (w->xcorr) w->ref_ring = jack_ringbuffer_create( size );
+	if (!w->ring || (w->xcorr && !w->ref_ring)) {
+		fprintf(stderr, "worker_init(): failed to create ring buffer.\n");
+		return -1;
+	}
+	jack_ringbuffer_mlock( w->ring );
+	if (w->ref_ring) jack_ringbuffer_mlock( w->ref_ring );
+	w->thread = -1;
+	w->overruns = 0;
+	w->dropped = 0;
+
+	return 0;
+}
+
+
+/* Analyse everything waiting, in the calling thread */
+void worker_run( worker_t *w )
+{
+	if (w->ring) while (worker_drain( w ));
+}
+
+
+/* Hand the channel to the pool thread with the fewest channels */
+int worker_start( worker_t *w )
+{
+	pool_thread_t *t;
+	int i, best = 0;
+
+	// Without a pool, whoever feeds the channel calls worker_run()
+	if (pool_size == 0) return 0;
+
+	for (i = 1; i < pool_size; i++) {
+		if (pool[i].count < pool[best].count) best = i;
+	}
+
+	t = &pool[best];
+	pthread_mutex_lock( &t->lock );
+	if (t->count >= WORKER_JOBS_MAX) {
+		pthread_mutex_unlock( &t->lock );
+		fprintf(stderr, "worker_start(): too many channels for the analysis threads.\n");
+		return -1;
+	}
+	t->jobs[ t->count++ ] = w;
+	w->thread = best;
+	pthread_mutex_unlock( &t->lock );
+
+	return 0;
+}
+
+
+/* Called from the process thread: hand samples over to the worker.
+   Without reference audio (ref NULL) the reference is silence, which
+   xcorr doesn't judge, the same as an unconnected reference port. */
+void worker_write( worker_t *w, const float *in, const float *ref, unsigned int nframes )
+{
+	const size_t bytes = sizeof(float) * nframes;
+
+	// Both rings must take the block, or neither, to keep them in step
+	if (jack_ringbuffer_write_space( w->ring ) < bytes ||
+	    (w->ref_ring && jack_ringbuffer_write_space( w->ref_ring ) < bytes)) {
+		__atomic_store_n( &w->overruns, w->overruns + 1, __ATOMIC_RELAXED );
+		__atomic_store_n( &w->dropped, w->dropped + nframes, __ATOMIC_RELAXED );
+		return;
+	}
+	ring_put( w->ring, in, bytes );
+	if (w->ref_ring) ring_put( w->ref_ring, ref, bytes );
+}
+
+
+void worker_finish( worker_t *w )
+{
+	// Once it is off the thread's list, the thread can't be using it
+	if (w->ring && w->thread >= 0) {
+		pool_thread_t *t = &pool[ w->thread ];
+		int i;
+
+		pthread_mutex_lock( &t->lock );
+		for (i = 0; i < t->count; i++) {
+			if (t->jobs[i] == w) {
+				t->jobs[i] = t->jobs[ --t->count ];
+				break;
+			}
+		}
+		pthread_mutex_unlock( &t->lock );
+		w->thread = -1;
+	}
+
+	if (w->ring) jack_ringbuffer_free( w->ring );
+	if (w->ref_ring) jack_ringbuffer_free( w->ref_ring );
+	w->ring = NULL;
+	w->ref_ring = NULL;
+}
@@ -0,0 +1,78 @@
+/*
+
+	worker.h
+	Pool of analysis worker threads for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+#include <jack/ringbuffer.h>
+
+#include "spectral.h"
+#include "fingerprint.h"
+#include "xcorr.h"
+
+
+#define WORKER_LATENCY_MS		1000	// Longest an analysis thread may take to get to a channel
+#define WORKER_PERIOD_MAX		8192	// Largest JACK period allowed for
+#define WORKER_BLOCK_SIZE		512		// Samples handed to the analysers at a time
+#define WORKER_BATCH			16		// Blocks taken from a channel before moving on
+#define WORKER_THREADS_MAX		16		// Largest pool of analysis threads
+#define WORKER_JOBS_MAX			64		// Channels one thread can look after
+
+
+/*
+	The process callback only copies samples into a channel's ring
+	buffer, straight into the space given by its write vector; a pool
+	of analysis threads takes them out in fixed size blocks and passes
+	them on to whichever of the (expensive) analysers are enabled,
+	reading them in place through the read vector. Each channel is
+	handed to one thread for as long as it exists, so its analysers
+	stay in that thread's caches. If a ring is full the analysis of
+	that block is dropped and counted; the process callback never
+	waits.
+	When comparing against a reference port, its audio goes into a
+	second ring which is always written and read in step with the first.
+*/
+typedef struct {
+	jack_ringbuffer_t *ring;		// Audio from the process thread
+	jack_ringbuffer_t *ref_ring;	// Reference audio, only used by xcorr
+	int thread;						// Pool thread looking after us (-1 if none)
+	unsigned long overruns;			// Process callbacks that didn't fit in the ring
+	unsigned long dropped;			// Frames not analysed because the ring was full
+
+	spectral_t *spectral;			// Analysers to run, NULL if disabled
+	loop_detector_t *loop;
+	xcorr_t *xcorr;
+
+	float block[WORKER_BLOCK_SIZE];		// Used when a block wraps around the ring
+	float ref_block[WORKER_BLOCK_SIZE];
+} worker_t;
+
+
+int worker_pool_start( int threads );
+int worker_pool_size();
+void worker_pool_finish();
+
+int worker_init( worker_t *w, unsigned int sample_rate );
+int worker_start( worker_t *w );
+void worker_run( worker_t *w );
+void worker_write( worker_t *w, const float *in, const float *ref, unsigned int nframes );
+void worker_finish( worker_t *w );
+
+
+#endif
@@ -0,0 +1,229 @@
+/*
+
+	xcorr.c
+	Processing chain stall detector for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "xcorr.h"
+#include "db.h"
+
+
+#define XCORR_FFT_SIZE		(4 * XCORR_WINDOW)
+#define XCORR_BINS			(XCORR_FFT_SIZE / 2 + 1)
+
+
+int xcorr_init( xcorr_t *xc, unsigned int sample_rate )
+{
+	xc->sample_rate = sample_rate;
+	xc->fft = fft_new( XCORR_FFT_SIZE );
+	xc->out = calloc( XCORR_WINDOW, sizeof(float) );
+	xc->ref = calloc( 2 * XCORR_WINDOW, sizeof(float) );
+	xc->buf = calloc( XCORR_FFT_SIZE, sizeof(float) );
+	xc->out_re = malloc( sizeof(float) * XCORR_BINS );
+	xc->out_im = malloc( sizeof(float) * XCORR_BINS );
+	xc->ref_re = malloc( sizeof(float) * XCORR_BINS );
+	xc->ref_im = malloc( sizeof(float) * XCORR_BINS );
+	if (!xc->fft || !xc->out || !xc->ref || !xc->buf ||
+	    !xc->out_re || !xc->out_im || !xc->ref_re || !xc->ref_im) {
+		fprintf(stderr, "xcorr_init(): failed to allocate memory.\n");
+		return -1;
+	}
+
+	xc->fill = 0;
+	xc->candidate = -1;
+	xc->candidate_count = 0;
+	xc->windows = 0;
+	xc->mismatched = 0;
+	xc->jumps = 0;
+	xc->delay = -1;
+	xc->latency = -1;
+	xc->previous_latency = -1;
+	xc->similarity = 0.0f;
+
+	return 0;
+}
+
+
+/* Normalised correlation between the output window and reference at delay */
+static
+float xcorr_similarity( xcorr_t *xc, int delay )
+{
+	const float *ref = xc->ref + XCORR_WINDOW - delay;
+	double dot = 0.0, eo = 0.0, er = 0.0;
+	unsigned int t;
+
+	for (t = 0; t < XCORR_WINDOW; t++) {
+		dot += xc->out[t] * ref[t];
+		eo += xc->out[t] * xc->out[t];
+		er += ref[t] * ref[t];
+	}
+
+	if (eo <= 0.0 || er <= 0.0) return 0.0f;
+	return dot / sqrt(eo * er);
+}
+
+
+/* Has the established latency moved? */
+static
+void xcorr_track_latency( xcorr_t *xc )
+{
+	const int tolerance = XCORR_JUMP_MS * xc->sample_rate / 1000;
+
+	if (xc->latency >= 0 && abs(xc->delay - xc->latency) <= tolerance) {
+		xc->candidate_count = 0;
+		return;
+	}
+
+	// Only believe a new latency once it has been seen a few times running
+	if (xc->candidate >= 0 && abs(xc->delay - xc->candidate) <= tolerance) {
+		xc->candidate_count++;
+	} else {
+		xc->candidate = xc->delay;
+		xc->candidate_count = 1;
+	}
+
+	if (xc->candidate_count >= XCORR_SETTLE) {
+		if (xc->latency >= 0) {
+			xc->previous_latency = xc->latency;
+			__atomic_add_fetch( &xc->jumps, 1, __ATOMIC_RELEASE );
+		}
+		xc->latency = xc->candidate;
+		xc->candidate_count = 0;
+	}
+}
+
+
+/* Compare one full window of output against the reference */
+static
+void xcorr_analyse( xcorr_t *xc )
+{
+	const float *ref_now = xc->ref + XCORR_WINDOW;
+	double eo = 0.0, er = 0.0;
+	float peak = 0.0f;
+	unsigned int k;
+	int d;
+
+	for (k = 0; k < XCORR_WINDOW; k++) {
+		eo += xc->out[k] * xc->out[k];
+		er += ref_now[k] * ref_now[k];
+	}
+
+	// Can't judge if either side is near silent
+	if (lin2db( sqrt(eo / XCORR_WINDOW) ) < XCORR_MIN_LEVEL ||
+	    lin2db( sqrt(er / XCORR_WINDOW) ) < XCORR_MIN_LEVEL) {
+		return;
+	}
+
+	// Still tracking at the established latency? Then no need to search.
+	if (xc->latency >= 0) {
+		xc->similarity = xcorr_similarity( xc, xc->latency );
+		if (xc->similarity >= xc->threshold) {
+			xc->delay = xc->latency;
+			xc->candidate_count = 0;
+			__atomic_add_fetch( &xc->windows, 1, __ATOMIC_RELEASE );
+			return;
+		}
+	}
+
+	memset( xc->buf, 0, sizeof(float) * XCORR_FFT_SIZE );
+	memcpy( xc->buf, xc->out, sizeof(float) * XCORR_WINDOW );
+	fft_real( xc->fft, xc->buf, xc->out_re, xc->out_im );
+
+	memcpy( xc->buf, xc->ref, sizeof(float) * 2 * XCORR_WINDOW );
+	fft_real( xc->fft, xc->buf, xc->ref_re, xc->ref_im );
+
+	// conj(OUT) * REF, with phase transform weighting
+	for (k = 0; k < XCORR_BINS; k++) {
+		const float re = xc->out_re[k] * xc->ref_re[k] + xc->out_im[k] * xc->ref_im[k];
+		const float im = xc->out_re[k] * xc->ref_im[k] - xc->out_im[k] * xc->ref_re[k];
+		const float mag = sqrtf(re * re + im * im) + 1e-20f;
+		xc->ref_re[k] = re / mag;
+		xc->ref_im[k] = im / mag;
+	}
+	fft_real_inverse( xc->fft, xc->ref_re, xc->ref_im, xc->buf );
+
+	// buf[m] is the correlation with the output delayed by XCORR_WINDOW - m
+	xc->delay = 0;
+	for (d = 0; d <= XCORR_WINDOW; d++) {
+		const float c = xc->buf[XCORR_WINDOW - d];
+		if (c > peak) {
+			peak = c;
+			xc->delay = d;
+		}
+	}
+
+	xc->similarity = xcorr_similarity( xc, xc->delay );
+	if (xc->similarity < xc->threshold) {
+		__atomic_add_fetch( &xc->mismatched, 1, __ATOMIC_RELEASE );
+	} else {
+		xcorr_track_latency( xc );
+	}
+	__atomic_add_fetch( &xc->windows, 1, __ATOMIC_RELEASE );
+}
+
+
+/* Collect matching blocks of output and reference (called from the worker thread) */
+void xcorr_process( xcorr_t *xc, const float *out, const float *ref, unsigned int nframes )
+{
+	while (nframes) {
+		unsigned int n = XCORR_WINDOW - xc->fill;
+		if (n > nframes) n = nframes;
+
+		memcpy( xc->out + xc->fill, out, sizeof(float) * n );
+		memcpy( xc->ref + XCORR_WINDOW + xc->fill, ref, sizeof(float) * n );
+		xc->fill += n;
+		out += n;
+		ref += n;
+		nframes -= n;
+
+		if (xc->fill == XCORR_WINDOW) {
+			xcorr_analyse( xc );
+
+			// Current reference window becomes the previous one
+			memcpy( xc->ref, xc->ref + XCORR_WINDOW, sizeof(float) * XCORR_WINDOW );
+			xc->fill = 0;
+		}
+	}
+}
+
+
+/* True if the output mostly didn't track the input since the last call */
+int xcorr_read( xcorr_t *xc, unsigned int *jumps )
+{
+	unsigned int windows = __atomic_exchange_n( &xc->windows, 0, __ATOMIC_ACQ_REL );
+	unsigned int mismatched = __atomic_exchange_n( &xc->mismatched, 0, __ATOMIC_ACQ_REL );
+
+	*jumps = __atomic_exchange_n( &xc->jumps, 0, __ATOMIC_ACQ_REL );
+	return (windows && mismatched * 2 > windows);
+}
+
+
+void xcorr_finish( xcorr_t *xc )
+{
+	fft_free( xc->fft );
+	free( xc->out );
+	free( xc->ref );
+	free( xc->buf );
+	free( xc->out_re );
+	free( xc->out_im );
+	free( xc->ref_re );
+	free( xc->ref_im );
+	memset( xc, 0, sizeof(xcorr_t) );
+}
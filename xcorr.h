@@ -0,0 +1,72 @@
+/*
+
+	xcorr.h
+	Processing chain stall detector for SilentJack
+	Copyright (C) 2006  Nicholas J. Humfrey
+
+	This program is free software; you can redistribute it and/or
+	modify it under the terms of the GNU General Public License
+	as published by the Free Software Foundation; either version 2
+	of the License, or (at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+*/
+
+#ifndef XCORR_H
+#define XCORR_H
+
+#include "fft.h"
+
+
+#define XCORR_WINDOW		16384	// Samples per comparison (also the longest delay)
+#define XCORR_MIN_LEVEL		-60.0f	// Windows quieter than this are not judged (dB)
+#define XCORR_JUMP_MS		2.0f	// Latency change considered to be a jump
+#define XCORR_SETTLE		3		// Windows a new latency must last for
+
+
+/*
+	Compares the output of a processing chain (the monitored port)
+	with its input (the reference port). Each window of output is
+	cross-correlated against the matching window of the reference plus
+	the window before it, so delays of up to XCORR_WINDOW samples can be
+	found. The delay is taken from the peak of the phase-transform
+	weighted correlation, which is sharp even for bass-heavy audio;
+	the similarity is the normalised correlation at that delay.
+*/
+typedef struct {
+	float threshold;				// Similarity below this is a mismatch (0 to 1)
+	unsigned int sample_rate;
+
+	fft_t *fft;						// Size 4 * XCORR_WINDOW
+	float *out;						// Window of monitored (output) audio
+	float *ref;						// Two windows of reference (input) audio
+	float *buf;						// Zero-padded FFT input / correlation output
+	float *out_re, *out_im;			// Spectrum of output window
+	float *ref_re, *ref_im;			// Spectrum of reference windows
+	unsigned int fill;				// Samples in current window
+
+	int candidate;					// Delay that might be the new latency
+	unsigned int candidate_count;	// Windows that candidate has lasted
+
+	// Written by the worker thread, collected by xcorr_read()
+	unsigned int windows;			// Windows judged since last read
+	unsigned int mismatched;		// Windows where the output didn't track input
+	unsigned int jumps;				// Latency jumps since last read
+	int delay;						// Delay found in last window (samples)
+	int latency;					// Established latency (samples, -1 if unknown)
+	int previous_latency;			// Latency before the last jump
+	float similarity;				// Similarity in last window (0 to 1)
+} xcorr_t;
+
+
+int xcorr_init( xcorr_t *xc, unsigned int sample_rate );
+void xcorr_process( xcorr_t *xc, const float *out, const float *ref, unsigned int nframes );
+int xcorr_read( xcorr_t *xc, unsigned int *jumps );
+void xcorr_finish( xcorr_t *xc );
+
+
+#endif